@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "compression.h"
+
+namespace compression {
+
+using namespace std::literals;
+
+namespace {
+
+// Частей, ожидающих сжатия: одна сжимается, пока заполняется следующая
+const size_t MAX_QUEUE_SIZE = 2;
+
+const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+}
+
+struct CompressingStreambuf::Deflater {
+    z_stream stream{};
+    char output[1 << 14];
+};
+
+CompressingStreambuf::CompressingStreambuf(std::streambuf* dest, Encoding encoding, size_t chunk_size)
+    : dest_(dest)
+    , deflater_(std::make_unique<Deflater>())
+    , chunk_size_(std::max<size_t>(chunk_size, 1024)) {
+    if(encoding == Encoding::NONE) {
+        throw std::invalid_argument("compression encoding is not set"s);
+    }
+
+    // 15 - окно 32 КБ, +16 - заголовок gzip вместо zlib
+    int window_bits = encoding == Encoding::GZIP ? 15 + 16 : 15;
+    if(deflateInit2(&deflater_->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                    window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("deflateInit2 failed"s);
+    }
+
+    buffer_.resize(chunk_size_);
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+    worker_ = std::thread(&CompressingStreambuf::Work, this);
+}
+
+CompressingStreambuf::~CompressingStreambuf() {
+    Finish();
+}
+
+void CompressingStreambuf::Finish() {
+    if(is_finished_) {
+        return;
+    }
+    is_finished_ = true;
+
+    Push(false, true);
+    worker_.join();
+    deflateEnd(&deflater_->stream);
+    setp(nullptr, nullptr);
+}
+
+CompressingStreambuf::int_type CompressingStreambuf::overflow(int_type ch) {
+    if(is_finished_) {
+        return traits_type::eof();
+    }
+
+    Push(false, false);
+    if(!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int CompressingStreambuf::sync() {
+    if(is_finished_) {
+        return dest_->pubsync();
+    }
+
+    Push(true, false);
+    WaitIdle();
+    return dest_->pubsync();
+}
+
+void CompressingStreambuf::Push(bool is_flush, bool is_last) {
+    Chunk chunk;
+    buffer_.resize(pptr() - pbase());
+    chunk.data = std::move(buffer_);
+    chunk.is_flush = is_flush;
+    chunk.is_last = is_last;
+
+    {
+        std::unique_lock lock(mutex_);
+        queue_changed_.wait(lock, [this] {
+            return queue_.size() < MAX_QUEUE_SIZE;
+        });
+        queue_.push_back(std::move(chunk));
+        ++pending_;
+    }
+    queue_changed_.notify_all();
+
+    buffer_ = std::string(is_last ? 0 : chunk_size_, '\0');
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+void CompressingStreambuf::WaitIdle() {
+    std::unique_lock lock(mutex_);
+    queue_changed_.wait(lock, [this] {
+        return pending_ == 0;
+    });
+}
+
+void CompressingStreambuf::Work() {
+    z_stream& stream = deflater_->stream;
+
+    for(;;) {
+        Chunk chunk;
+        {
+            std::unique_lock lock(mutex_);
+            queue_changed_.wait(lock, [this] {
+                return !queue_.empty();
+            });
+            chunk = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        queue_changed_.notify_all();
+
+        int flush = chunk.is_last ? Z_FINISH : (chunk.is_flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        stream.next_in = reinterpret_cast<Bytef*>(chunk.data.data());
+        stream.avail_in = static_cast<uInt>(chunk.data.size());
+        do {
+            stream.next_out = reinterpret_cast<Bytef*>(deflater_->output);
+            stream.avail_out = sizeof(deflater_->output);
+            deflate(&stream, flush);
+            dest_->sputn(deflater_->output, sizeof(deflater_->output) - stream.avail_out);
+        } while(stream.avail_out == 0);
+
+        {
+            std::lock_guard lock(mutex_);
+            --pending_;
+        }
+        queue_changed_.notify_all();
+
+        if(chunk.is_last) {
+            return;
+        }
+    }
+}
+
+Base64Streambuf::Base64Streambuf(std::streambuf* dest)
+    : dest_(dest) {
+}
+
+Base64Streambuf::~Base64Streambuf() {
+    Finish();
+}
+
+void Base64Streambuf::Finish() {
+    // Encode здесь не подходит: он может вывести закодированное раньше, чем
+    // лишние символы заменятся на '='
+    if(tail_size_ > 0) {
+        unsigned value = (tail_[0] << 16) | ((tail_size_ > 1 ? tail_[1] : 0) << 8);
+        encoded_ += BASE64_ALPHABET[(value >> 18) & 0x3f];
+        encoded_ += BASE64_ALPHABET[(value >> 12) & 0x3f];
+        encoded_ += tail_size_ > 1 ? BASE64_ALPHABET[(value >> 6) & 0x3f] : '=';
+        encoded_ += '=';
+        tail_size_ = 0;
+    }
+    FlushEncoded();
+}
+
+Base64Streambuf::int_type Base64Streambuf::overflow(int_type ch) {
+    if(!traits_type::eq_int_type(ch, traits_type::eof())) {
+        char c = traits_type::to_char_type(ch);
+        xsputn(&c, 1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize Base64Streambuf::xsputn(const char* s, std::streamsize count) {
+    const auto* data = reinterpret_cast<const unsigned char*>(s);
+    size_t size = static_cast<size_t>(count);
+
+    // Сначала дополняется тройка, оставшаяся от прошлой записи
+    while(tail_size_ > 0 && tail_size_ < 3 && size > 0) {
+        tail_[tail_size_++] = *data++;
+        --size;
+    }
+    if(tail_size_ == 3) {
+        Encode(tail_, 3);
+        tail_size_ = 0;
+    }
+
+    size_t full = size - size % 3;
+    Encode(data, full);
+    data += full;
+    size -= full;
+
+    while(size > 0) {
+        tail_[tail_size_++] = *data++;
+        --size;
+    }
+    return count;
+}
+
+int Base64Streambuf::sync() {
+    FlushEncoded();
+    return dest_->pubsync();
+}
+
+void Base64Streambuf::Encode(const unsigned char* data, size_t size) {
+    for(size_t i = 0; i + 3 <= size; i += 3) {
+        unsigned value = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        encoded_ += BASE64_ALPHABET[(value >> 18) & 0x3f];
+        encoded_ += BASE64_ALPHABET[(value >> 12) & 0x3f];
+        encoded_ += BASE64_ALPHABET[(value >> 6) & 0x3f];
+        encoded_ += BASE64_ALPHABET[value & 0x3f];
+
+        if(encoded_.size() >= 4096) {
+            FlushEncoded();
+        }
+    }
+}
+
+void Base64Streambuf::FlushEncoded() {
+    dest_->sputn(encoded_.data(), encoded_.size());
+    encoded_.clear();
+}
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+#include "encoding.h"
+
+/*
+ * Сжатие ответов форматами gzip и deflate (zlib) через библиотеку zlib
+ */
+
+namespace compression {
+
+// Буфер потока, сжимающий всё записанное в него и передающий результат в буфер dest.
+// Сжатие выполняется в отдельном потоке: заполненная часть отдаётся ему, а запись
+// продолжается в следующую, поэтому сжатие идёт одновременно с формированием данных.
+// Пока сжатие не завершено, в dest нельзя писать напрямую
+class CompressingStreambuf : public std::streambuf {
+public:
+    CompressingStreambuf(std::streambuf* dest, Encoding encoding, size_t chunk_size = 1 << 16);
+    ~CompressingStreambuf() override;
+
+    // Сжимает остаток, дописывает окончание потока и дожидается рабочего потока.
+    // После вызова запись в буфер недопустима
+    void Finish();
+
+protected:
+    int_type overflow(int_type ch) override;
+    // Передаёт в dest всё записанное к этому моменту (Z_SYNC_FLUSH)
+    int sync() override;
+
+private:
+    struct Deflater;
+
+    struct Chunk {
+        std::string data;
+        bool is_flush = false;
+        bool is_last = false;
+    };
+
+    std::streambuf* dest_;
+    std::unique_ptr<Deflater> deflater_;
+    std::string buffer_;
+    size_t chunk_size_;
+    bool is_finished_ = false;
+
+    // Очередь частей для рабочего потока. Её длина ограничена, чтобы при медленном
+    // сжатии не накапливать в памяти весь ответ
+    std::mutex mutex_;
+    std::condition_variable queue_changed_;
+    std::deque<Chunk> queue_;
+    size_t pending_ = 0;
+    std::thread worker_;
+
+    void Push(bool is_flush, bool is_last);
+    void WaitIdle();
+    void Work();
+};
+
+// Буфер потока, кодирующий записанное в base64 для вставки двоичных данных в строку JSON
+class Base64Streambuf : public std::streambuf {
+public:
+    explicit Base64Streambuf(std::streambuf* dest);
+    ~Base64Streambuf() override;
+
+    // Кодирует неполную тройку байт с дополнением '='
+    void Finish();
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize count) override;
+    int sync() override;
+
+private:
+    std::streambuf* dest_;
+    unsigned char tail_[3] = {};
+    int tail_size_ = 0;
+    std::string encoded_;
+
+    void Encode(const unsigned char* data, size_t size);
+    void FlushEncoded();
+};
+
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "domain.h"
 
 /*
@@ -17,8 +19,35 @@
 
 namespace domain {
 
-Stop::Stop(std::string_view title, double x, double y)
-    : title_(title), coords_({x,y})
+namespace {
+
+const size_t NAME_BLOCK_SIZE = 1 << 16;
+
+}
+
+void StopColumns::SetCompact(bool compact) {
+    is_compact_ = compact;
+}
+
+size_t StopColumns::Add(std::string_view name, geo::Coordinates coords) {
+    if(is_compact_) {
+        fixed_coords_.Add(coords);
+    } else {
+        coords_.Add(coords);
+    }
+
+    if(name_blocks_.empty() || name_blocks_.back().capacity() - name_blocks_.back().size() < name.size()) {
+        name_blocks_.emplace_back().reserve(std::max(NAME_BLOCK_SIZE, name.size()));
+    }
+    std::string& block = name_blocks_.back();
+    size_t offset = block.size();
+    block.append(name);
+    names_.push_back({block.data() + offset, name.size()});
+    return Size() - 1;
+}
+
+Stop::Stop(const StopColumns* columns, size_t id)
+    : columns_(columns), id_(id)
 {}
 
 namespace detail {
@@ -27,6 +56,17 @@ namespace detail {
         size_t stop_two = stop_hasher_(static_cast<const void*>(stops_pair.second));
         return stop_one + stop_two*37;
     }
+
+    ContentHasher& ContentHasher::AddString(std::string_view data) {
+        for(char c : data) {
+            value_ ^= static_cast<unsigned char>(c);
+            value_ *= 1099511628211ull;
+        }
+        // Длина разделяет соседние строки: "ab" + "c" и "a" + "bc" дают разный хэш
+        value_ ^= data.size();
+        value_ *= 1099511628211ull;
+        return *this;
+    }
 }
 
 Bus::Bus(std::string_view title, const std::vector<Stop*>& list, bool is_round, Stop* last_stop)
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
 #include <string_view>
 #include <string>
+#include <type_traits>
 #include<vector>
 
 #include"geo.h"
@@ -19,11 +22,69 @@
  */
 
 namespace domain {
+
+// Атрибуты остановок по столбцам, номер остановки - индекс в каждом столбце.
+// Проходы по координатам читают только массивы широт и долгот, не затрагивая имён
+class StopColumns {
+public:
+    // Координаты хранятся с фиксированной точкой. Задаётся до добавления остановок
+    void SetCompact(bool compact);
+    bool IsCompact() const {
+        return is_compact_;
+    }
+
+    // Возвращает номер остановки
+    size_t Add(std::string_view name, geo::Coordinates coords);
+
+    size_t Size() const {
+        return names_.size();
+    }
+
+    // Имя действительно всё время жизни столбцов: блоки с именами не перемещаются
+    std::string_view GetName(size_t id) const {
+        return names_[id];
+    }
+
+    geo::Coordinates GetCoordinates(size_t id) const {
+        if(is_compact_) {
+            return fixed_coords_.Get(id);
+        }
+        return {coords_.lat[id], coords_.lng[id]};
+    }
+
+    // Заполнен один из массивов, в зависимости от IsCompact
+    const geo::CoordinatesArray& GetCoordinatesArray() const {
+        return coords_;
+    }
+    const geo::FixedCoordinatesArray& GetFixedCoordinatesArray() const {
+        return fixed_coords_;
+    }
+
+private:
+    bool is_compact_ = false;
+    geo::CoordinatesArray coords_;
+    geo::FixedCoordinatesArray fixed_coords_;
+    // Имена подряд в блоках, каждый блок заполняется не дальше зарезервированного
+    // размера и поэтому не перевыделяется
+    std::deque<std::string> name_blocks_;
+    std::vector<std::string_view> names_;
+};
+
+// Остановка - строка в столбцах StopColumns. Объекты не перемещаются,
+// поэтому указатели на них служат идентификаторами остановок
 struct Stop {
-    Stop(std::string_view title, double x, double y);
+    Stop(const StopColumns* columns, size_t id);
 
-    std::string title_;
-    geo::Coordinates coords_;
+    std::string_view GetTitle() const {
+        return columns_->GetName(id_);
+    }
+    geo::Coordinates GetCoordinates() const {
+        return columns_->GetCoordinates(id_);
+    }
+
+    const StopColumns* columns_;
+    // Порядковый номер остановки в справочнике
+    size_t id_ = 0;
 };
 
 namespace detail {
@@ -33,6 +94,25 @@ namespace detail {
         private:
             std::hash<const void*> stop_hasher_;
     };
+
+    // Накопительный хэш FNV-1a, не зависящий от запуска программы
+    class ContentHasher {
+    public:
+        ContentHasher& AddString(std::string_view data);
+
+        template <typename T>
+        ContentHasher& AddValue(T value) {
+            static_assert(std::is_arithmetic_v<T>);
+            return AddString({reinterpret_cast<const char*>(&value), sizeof(value)});
+        }
+
+        uint64_t Get() const {
+            return value_;
+        }
+
+    private:
+        uint64_t value_ = 14695981039346656037ull;
+    };
 }
 
 struct Bus {
@@ -42,5 +122,9 @@ struct Bus {
     std::vector<Stop*> stops_;
     Stop* last_stop_;
     bool is_round_ = false;
+    // Расстояния от начала маршрута до каждой из stops_ по дорогам и по прямым.
+    // Считаются справочником для всех маршрутов сразу
+    std::vector<size_t> road_distances_;
+    std::vector<double> geo_distances_;
 };
 }
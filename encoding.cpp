@@ -0,0 +1,31 @@
+#include "encoding.h"
+
+namespace compression {
+
+using namespace std::literals;
+
+std::optional<Encoding> ParseEncoding(std::string_view name) {
+    if(name == "gzip"sv) {
+        return Encoding::GZIP;
+    }
+    if(name == "deflate"sv) {
+        return Encoding::DEFLATE;
+    }
+    if(name == "none"sv) {
+        return Encoding::NONE;
+    }
+    return std::nullopt;
+}
+
+std::string_view GetEncodingName(Encoding encoding) {
+    switch(encoding) {
+    case Encoding::GZIP:
+        return "gzip"sv;
+    case Encoding::DEFLATE:
+        return "deflate"sv;
+    default:
+        return "none"sv;
+    }
+}
+
+}
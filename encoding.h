@@ -0,0 +1,23 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+/*
+ * Форматы сжатия ответов. Отделены от compression.h, чтобы разбор запросов
+ * не зависел от реализации сжатия
+ */
+
+namespace compression {
+
+enum class Encoding {
+    NONE,
+    GZIP,
+    DEFLATE,
+};
+
+// "gzip", "deflate" или "none"; для прочих строк - nullopt
+std::optional<Encoding> ParseEncoding(std::string_view name);
+std::string_view GetEncodingName(Encoding encoding);
+
+}
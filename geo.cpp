@@ -1,8 +1,13 @@
 #define _USE_MATH_DEFINES
 #include "geo.h"
 
+#include <algorithm>
 #include <cmath>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace geo {
 
 bool Coordinates::operator==(const Coordinates& other) const {
@@ -12,15 +17,115 @@ bool Coordinates::operator!=(const Coordinates& other) const {
     return !(*this == other);
 }
 
-double ComputeDistance(Coordinates from, Coordinates to) {
-    using namespace std;
-    if (from == to) {
-        return 0;
-    }
+PreparedCoordinates PreparedCoordinates::From(Coordinates coords) {
     static const double dr = M_PI / 180.;
-    return acos(sin(from.lat * dr) * sin(to.lat * dr)
-                + cos(from.lat * dr) * cos(to.lat * dr) * cos(abs(from.lng - to.lng) * dr))
-        * earth_radius;
+    PreparedCoordinates result;
+    result.lat_rad = coords.lat * dr;
+    result.lng_rad = coords.lng * dr;
+    result.sin_lat = std::sin(result.lat_rad);
+    result.cos_lat = std::cos(result.lat_rad);
+    result.sin_lng = std::sin(result.lng_rad);
+    result.cos_lng = std::cos(result.lng_rad);
+    return result;
+}
+
+void PreparedArray::Add(const PreparedCoordinates& coords) {
+    lat_rad.push_back(coords.lat_rad);
+    lng_rad.push_back(coords.lng_rad);
+    cos_lat.push_back(coords.cos_lat);
+    x.push_back(coords.cos_lat * coords.cos_lng);
+    y.push_back(coords.cos_lat * coords.sin_lng);
+    z.push_back(coords.sin_lat);
+}
+
+void PreparedArray::Add(const PreparedArray& other, std::size_t index) {
+    lat_rad.push_back(other.lat_rad[index]);
+    lng_rad.push_back(other.lng_rad[index]);
+    cos_lat.push_back(other.cos_lat[index]);
+    x.push_back(other.x[index]);
+    y.push_back(other.y[index]);
+    z.push_back(other.z[index]);
+}
+
+void PreparedArray::Reserve(std::size_t size) {
+    for(auto* array : {&lat_rad, &lng_rad, &cos_lat, &x, &y, &z}) {
+        array->reserve(size);
+    }
+}
+
+namespace {
+
+// Длины хорд между точками единичной сферы
+void ComputeChords(const PreparedArray& from, const PreparedArray& to, double* chords) {
+    std::size_t size = from.Size();
+    std::size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 2 <= size; i += 2) {
+        __m128d dx = _mm_sub_pd(_mm_loadu_pd(&to.x[i]), _mm_loadu_pd(&from.x[i]));
+        __m128d dy = _mm_sub_pd(_mm_loadu_pd(&to.y[i]), _mm_loadu_pd(&from.y[i]));
+        __m128d dz = _mm_sub_pd(_mm_loadu_pd(&to.z[i]), _mm_loadu_pd(&from.z[i]));
+        __m128d sum = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+        _mm_storeu_pd(&chords[i], _mm_sqrt_pd(sum));
+    }
+#endif
+    for(; i < size; ++i) {
+        double dx = to.x[i] - from.x[i];
+        double dy = to.y[i] - from.y[i];
+        double dz = to.z[i] - from.z[i];
+        chords[i] = std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+}
+
+// Косинус средней широты заменён средним косинусов концов отрезка, разница - второго порядка малости
+void ComputeEquirectangular(const PreparedArray& from, const PreparedArray& to, double* distances) {
+    std::size_t size = from.Size();
+    std::size_t i = 0;
+#ifdef __SSE2__
+    const __m128d pi = _mm_set1_pd(M_PI);
+    const __m128d two_pi = _mm_set1_pd(2 * M_PI);
+    const __m128d half = _mm_set1_pd(0.5);
+    const __m128d radius = _mm_set1_pd(earth_radius);
+    for(; i + 2 <= size; i += 2) {
+        __m128d dlng = _mm_sub_pd(_mm_loadu_pd(&to.lng_rad[i]), _mm_loadu_pd(&from.lng_rad[i]));
+        // Разность долгот приводится к [-pi, pi] для отрезков через 180-й меридиан
+        dlng = _mm_sub_pd(dlng, _mm_and_pd(_mm_cmpgt_pd(dlng, pi), two_pi));
+        dlng = _mm_add_pd(dlng, _mm_and_pd(_mm_cmplt_pd(dlng, _mm_sub_pd(_mm_setzero_pd(), pi)), two_pi));
+
+        __m128d cos_mid = _mm_mul_pd(_mm_add_pd(_mm_loadu_pd(&from.cos_lat[i]), _mm_loadu_pd(&to.cos_lat[i])), half);
+        __m128d dx = _mm_mul_pd(dlng, cos_mid);
+        __m128d dy = _mm_sub_pd(_mm_loadu_pd(&to.lat_rad[i]), _mm_loadu_pd(&from.lat_rad[i]));
+        __m128d length = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)));
+        _mm_storeu_pd(&distances[i], _mm_mul_pd(length, radius));
+    }
+#endif
+    for(; i < size; ++i) {
+        double dlng = to.lng_rad[i] - from.lng_rad[i];
+        if(dlng > M_PI) {
+            dlng -= 2 * M_PI;
+        } else if(dlng < -M_PI) {
+            dlng += 2 * M_PI;
+        }
+        double dx = dlng * (from.cos_lat[i] + to.cos_lat[i]) * 0.5;
+        double dy = to.lat_rad[i] - from.lat_rad[i];
+        distances[i] = std::sqrt(dx * dx + dy * dy) * earth_radius;
+    }
+}
+
+}
+
+void ComputeDistances(const PreparedArray& from, const PreparedArray& to,
+                      DistanceFormula formula, std::vector<double>& distances) {
+    distances.resize(from.Size());
+    if(formula == DistanceFormula::EQUIRECTANGULAR) {
+        ComputeEquirectangular(from, to, distances.data());
+        return;
+    }
+
+    // Центральный угол по хорде c: 2 * asin(c / 2)
+    ComputeChords(from, to, distances.data());
+    for(double& distance : distances) {
+        distance = 2 * std::asin(std::min(distance * 0.5, 1.0)) * earth_radius;
+    }
 }
 
 }  // namespace geo
@@ -524,5 +524,83 @@ void Print(const Document& doc, std::ostream& output) {
     }
 }
 
+EscapingStreambuf::EscapingStreambuf(std::streambuf* dest)
+    : dest_(dest) {
+    setp(buffer_, buffer_ + sizeof(buffer_));
+}
+
+EscapingStreambuf::~EscapingStreambuf() {
+    Flush();
+}
+
+EscapingStreambuf::int_type EscapingStreambuf::overflow(int_type ch) {
+    Flush();
+    if(!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize EscapingStreambuf::xsputn(const char* s, std::streamsize count) {
+    Flush();
+    WriteEscaped(s, count);
+    return count;
+}
+
+int EscapingStreambuf::sync() {
+    Flush();
+    return dest_->pubsync();
+}
+
+void EscapingStreambuf::Flush() {
+    WriteEscaped(pbase(), pptr() - pbase());
+    setp(buffer_, buffer_ + sizeof(buffer_));
+}
+
+void EscapingStreambuf::WriteEscaped(const char* s, std::streamsize count) {
+    static const char hex[] = "0123456789abcdef";
+
+    // Участки без спецсимволов передаются в dest_ целиком
+    std::streamsize begin = 0;
+    for(std::streamsize i = 0; i < count; ++i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if(c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        dest_->sputn(s + begin, i - begin);
+        begin = i + 1;
+
+        switch(c) {
+        case '"':  dest_->sputn("\\\"", 2); break;
+        case '\\': dest_->sputn("\\\\", 2); break;
+        case '\n': dest_->sputn("\\n", 2); break;
+        case '\r': dest_->sputn("\\r", 2); break;
+        case '\t': dest_->sputn("\\t", 2); break;
+        default: {
+            const char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0f]};
+            dest_->sputn(escaped, sizeof(escaped));
+        }
+        }
+    }
+    dest_->sputn(s + begin, count - begin);
+}
+
+StringStreambuf::StringStreambuf(std::string& str)
+    : str_(str) {
+}
+
+StringStreambuf::int_type StringStreambuf::overflow(int_type ch) {
+    if(!traits_type::eq_int_type(ch, traits_type::eof())) {
+        str_ += traits_type::to_char_type(ch);
+    }
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize StringStreambuf::xsputn(const char* s, std::streamsize count) {
+    str_.append(s, count);
+    return count;
+}
 
 }  // namespace json
@@ -84,4 +84,37 @@ Document Load(std::istream& input);
 
 void Print(const Document& doc, std::ostream& output);
 
+// Буфер потока, экранирующий всё записанное в него для строкового литерала JSON
+// и передающий результат в буфер dest. Кавычки вокруг строки не выводит.
+class EscapingStreambuf : public std::streambuf {
+public:
+    explicit EscapingStreambuf(std::streambuf* dest);
+    ~EscapingStreambuf() override;
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize count) override;
+    int sync() override;
+
+private:
+    std::streambuf* dest_;
+    char buffer_[1024];
+
+    void Flush();
+    void WriteEscaped(const char* s, std::streamsize count);
+};
+
+// Буфер потока, дописывающий всё записанное в него в конец строки str
+class StringStreambuf : public std::streambuf {
+public:
+    explicit StringStreambuf(std::string& str);
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize count) override;
+
+private:
+    std::string& str_;
+};
+
 }  // namespace json
@@ -2,7 +2,9 @@
 #include <algorithm>
 #include <variant>
 
+#include "compression.h"
 #include "json_reader.h"
+#include "msgpack.h"
 
 /*
  * Здесь можно разместить код наполнения транспортного справочника данными из JSON,
@@ -14,149 +16,396 @@ using namespace json;
 using namespace transport_list;
 using namespace renderer;
 
-std::string Print(const Node& node) {
-    std::ostringstream out;
-    Print(Document{node}, out);
-    return out.str();
+void JsonReader::SetInputFormat(DataFormat format) {
+    input_format_ = format;
+}
+
+void JsonReader::SetOutputFormat(DataFormat format) {
+    output_format_ = format;
 }
 
 void JsonReader::SetData(TransportCatalogue& catalog,
                          MapRenderer& render,
                          std::istream& input) {
-    json_data_ = json::Load(input).GetRoot().AsMap();
-    SetStops(catalog);
-    SetBuses(catalog);
-    SetDistances(catalog);
-    SetSetRenderSettings(render);
-}
-
-json::Array JsonReader::GetData(TransportCatalogue& catalog,
-                                renderer::MapRenderer& render) {
-    json::Array result;
+    bool is_msgpack = input_format_ == DataFormat::MSGPACK
+            || (input_format_ == DataFormat::AUTO && msgpack::IsMsgPack(input));
 
-    if(json_data_.find("stat_requests"s) == json_data_.end()) {
-        return result;
+    response_format_ = output_format_;
+    if(response_format_ == DataFormat::AUTO) {
+        response_format_ = is_msgpack ? DataFormat::MSGPACK : DataFormat::JSON;
     }
 
-    output_requests_ = json_data_.at("stat_requests"s).AsArray();
+    schema::BaseRequests base_requests;
+
+    // Дерево входного документа живёт только до разбора в типизированные запросы,
+    // справочник заполняется уже после его освобождения
+    {
+        const Document doc = is_msgpack ? msgpack::Load(input) : json::Load(input);
+        const Dict& data = doc.GetRoot().AsMap();
+
+        if(auto it = data.find("base_requests"s); it != data.end()) {
+            base_requests = schema::ParseBaseRequests(it->second.AsArray());
+        }
+
+        if(auto it = data.find("render_settings"s); it != data.end()) {
+            SetSetRenderSettings(render, it->second.AsMap());
+        }
 
-    for(const auto& req : output_requests_) {
-        if(req.AsMap().at("type"s) == "Bus"s) {
-            result.push_back(GetBusInfo(catalog, req.AsMap()));
-        } else if(req.AsMap().at("type"s) == "Stop"s) {
-            result.push_back(GetStopInfo(catalog, req.AsMap()));
-        } else if(req.AsMap().at("type"s) == "Map"s) {
-            result.push_back(GetMap(render, req.AsMap()));
+        if(auto it = data.find("stat_requests"s); it != data.end()) {
+            stat_requests_ = schema::ParseStatRequests(it->second.AsArray());
         }
     }
-cout << Print(result) << endl;
-    return result;
+
+    SetStops(catalog, base_requests.stops);
+    SetBuses(catalog, base_requests.buses);
+    base_requests.buses = {};
+    SetDistances(catalog, base_requests.stops);
 }
 
-void JsonReader::SetStops(TransportCatalogue& catalog) {
-    if(json_data_.find("base_requests"s) == json_data_.end()) {
+void JsonReader::GetData(TransportCatalogue& catalog,
+                         renderer::MapRenderer& render,
+                         std::ostream& output) {
+    if(!stat_requests_) {
         return;
     }
 
-    input_requests_ = json_data_.at("base_requests"s).AsArray();
+    size_t count = std::count_if(stat_requests_->begin(),
+                                 stat_requests_->end(),
+                                 [](const auto& req) {
+                                    return req.type != schema::RequestType::UNKNOWN;
+                                });
 
-    std::sort(input_requests_.begin(),
-              input_requests_.end(),
-              [](const auto& item1, const auto& item2){
-                    return item1.AsMap().at("type") != item2.AsMap().at("type")
-                             ? item1.AsMap().at("type").AsString() > item2.AsMap().at("type").AsString()
-                              : item1.AsMap().at("name").AsString() < item2.AsMap().at("name").AsString();
-                });
+    // Ответы выводятся по мере обработки запросов, массив ответов целиком не собирается
+    if(response_format_ == DataFormat::MSGPACK) {
+        msgpack::PrintArrayBegin(count, output);
+    } else {
+        output << "[\n"s;
+    }
 
-    auto end = std::find_if(input_requests_.begin(),
-                            input_requests_.end(),
-                            [](const auto& item){
-                    return item.AsMap().at("type").AsString() == "Bus";
-                });
+    bool is_first = true;
+    for(const auto& req : *stat_requests_) {
+        if(req.type == schema::RequestType::UNKNOWN) {
+            continue;
+        }
 
-    for(auto i = input_requests_.begin(); i != end; ++i) {
-        catalog.AddStop(i->AsMap().at("name"s).AsString(),
-                        {i->AsMap().at("latitude").AsDouble(),
-                        i->AsMap().at("longitude").AsDouble()});
-    }
-}
+        if(response_format_ == DataFormat::JSON && !is_first) {
+            output << ",\n"s;
+        }
+        is_first = false;
 
-void JsonReader::SetBuses(TransportCatalogue& catalog) {
-    auto begin = std::find_if(input_requests_.begin(),
-                              input_requests_.end(),
-                              [](const auto& item){
-                    return item.AsMap().at("type").AsString() == "Bus";
-                });
+        // Карту в неизвестной теме не строим, ответ с ошибкой формирует GetMap
+        std::optional<renderer::MapDelta> delta;
+        if(req.type == schema::RequestType::MAP && req.base_version && req.theme.empty()) {
+            delta = render.GetMapDelta(*req.base_version);
+        }
 
-    for(auto i = begin; i != input_requests_.end(); ++i) {
-        std::deque<std::string> data;
+        // Неизменившуюся карту и изменения карты тоже выводим через json::Dict
+        bool is_map = req.type == schema::RequestType::MAP_TILE
+                || (req.type == schema::RequestType::MAP && (req.theme.empty() || render.HasTheme(req.theme))
+                    && !IsNotModified(render, req) && !delta);
+        if(is_map && req.compression != compression::Encoding::NONE) {
+            if(response_format_ == DataFormat::JSON) {
+                PrintCompressedMap(render, req, output);
+            } else {
+                PrintBinaryCompressedMap(render, req, output);
+            }
+            continue;
+        }
+        if(is_map && req.type == schema::RequestType::MAP && response_format_ == DataFormat::JSON) {
+            PrintMap(render, req, output);
+            continue;
+        }
+        if(req.type == schema::RequestType::MAP_TILE && response_format_ == DataFormat::JSON) {
+            PrintMapTile(render, req, output);
+            continue;
+        }
 
-        for(const auto& item : i->AsMap().at("stops"s).AsArray()) {
-            data.push_back(item.AsString());
+        json::Dict result;
+
+        switch(req.type) {
+        case schema::RequestType::BUS:
+            result = GetBusInfo(catalog, req);
+            break;
+        case schema::RequestType::STOP:
+            result = GetStopInfo(catalog, req);
+            break;
+        case schema::RequestType::BUS_SEGMENT:
+            result = GetBusSegment(catalog, req);
+            break;
+        case schema::RequestType::MAP:
+            result = delta ? GetMapDelta(*delta, req) : GetMap(render, req);
+            break;
+        case schema::RequestType::MAP_TILE:
+            result = GetMapTile(render, req);
+            break;
+        default:
+            break;
         }
 
+        if(response_format_ == DataFormat::MSGPACK) {
+            msgpack::Print(Document{move(result)}, output);
+        } else {
+            Document::StreamUpdForDict(output, result);
+        }
+    }
+
+    if(response_format_ == DataFormat::JSON) {
+        output << "]"s << endl;
+    } else {
+        output.flush();
+    }
+
+    stat_requests_.reset();
+}
+
+void JsonReader::SetStops(TransportCatalogue& catalog,
+                          const std::vector<schema::StopRequest>& stops) {
+    for(const auto& stop : stops) {
+        catalog.AddStop(stop.name, {stop.latitude, stop.longitude});
+    }
+}
+
+void JsonReader::SetBuses(TransportCatalogue& catalog,
+                          const std::vector<schema::BusRequest>& buses) {
+    for(const auto& bus : buses) {
+        std::deque<std::string> data(bus.stops.begin(), bus.stops.end());
+
         std::string last_stop = data[data.size()-1];
 
-        if(!i->AsMap().at("is_roundtrip"s).AsBool()) {
+        if(!bus.is_roundtrip) {
             for(auto i = data.end() - 2; i != data.begin(); --i) {
                 data.push_back(*i);
             }
             data.push_back(data[0]);
         }
 
-        catalog.AddBus(i->AsMap().at("name"s).AsString(), data, i->AsMap().at("is_roundtrip"s).AsBool(), last_stop);
+        catalog.AddBus(bus.name, data, bus.is_roundtrip, last_stop);
+    }
+}
+
+void JsonReader::SetDistances(TransportCatalogue& catalog,
+                              const std::vector<schema::StopRequest>& stops) {
+    for(const auto& stop : stops) {
+        domain::Stop* from = catalog.GetAllStops().at(stop.name);
+        for(const auto& [to, distance] : stop.road_distances) {
+            catalog.SetDistance(from, catalog.GetAllStops().at(to), distance);
+        }
+    }
+}
+
+std::optional<std::string> JsonReader::GetETag(const MapRenderer& map, const schema::StatRequest& request) {
+    if(request.type != schema::RequestType::MAP || (!request.if_none_match && !request.base_version)) {
+        return std::nullopt;
     }
+    return map.GetETag(request.theme);
 }
 
-void JsonReader::SetDistances(TransportCatalogue& catalog) {
+bool JsonReader::IsNotModified(const MapRenderer& map, const schema::StatRequest& request) {
+    std::optional<std::string> etag = GetETag(map, request);
+    return etag && request.if_none_match && *etag == *request.if_none_match;
+}
 
-    auto end = std::find_if(input_requests_.begin(),
-                            input_requests_.end(),
-                            [](const auto& item){
-                    return item.AsMap().at("type").AsString() == "Bus";
-                });
+json::Dict JsonReader::GetMap(MapRenderer& map, const schema::StatRequest& request) {
+    json::Dict result;
+    if(!request.theme.empty() && !map.HasTheme(request.theme)) {
+        result.insert({"error_message"s, "not found"s});
+        result.insert({"request_id", request.id});
+        return result;
+    }
 
-    for(auto item = input_requests_.begin(); item != end; ++item) {
-        auto stop_distances = item->AsMap().at("road_distances"s).AsMap();
-        for(const auto& i : stop_distances) {
-            catalog.GetStopsDistances().insert({{catalog.GetAllStops().at(item->AsMap().at("name"s).AsString()),
-                                 catalog.GetAllStops().at(i.first)},
-                                i.second.AsInt()});
+    std::optional<std::string> etag = GetETag(map, request);
+    if(etag) {
+        result.insert({"etag"s, *etag});
+    }
+
+    if(IsNotModified(map, request)) {
+        result.insert({"not_modified"s, true});
+    } else if(request.theme.empty()) {
+        // В MessagePack строки не экранируются, поэтому карта передаётся как есть
+        result.insert({"map"s, map.GetSvg()});
+    } else {
+        result.insert({"map"s, map.GetThemeSvg(request.theme)});
+    }
+    result.insert({"request_id", request.id});
+    return result;
+}
+
+// Элементы ответа - словари {"shape", "label", "position"} по ключам элементов.
+// Куда вставлять элемент по position, описано у renderer::MapDelta
+json::Dict JsonReader::GetMapDelta(const renderer::MapDelta& delta, const schema::StatRequest& request) {
+    // Document::StreamUpdForDict выводит строки и ключи как есть, поэтому для JSON
+    // фрагменты svg и ключи с названиями экранируются заранее. В MessagePack они
+    // передаются без изменений
+    auto escape = [this](const std::string& str) {
+        if(response_format_ != DataFormat::JSON) {
+            return str;
+        }
+        std::string result;
+        json::StringStreambuf string_buf(result);
+        {
+            json::EscapingStreambuf escaping_buf(&string_buf);
+            escaping_buf.sputn(str.data(), str.size());
         }
+        return result;
+    };
+    auto to_dict = [&escape](const std::vector<renderer::ElementDelta>& elements) {
+        json::Dict result;
+        for(const auto& element : elements) {
+            result.insert({escape(element.key), json::Dict{{"shape"s, escape(element.shape)},
+                                                           {"label"s, escape(element.label)},
+                                                           {"position"s, static_cast<int>(element.position)}}});
+        }
+        return result;
+    };
+
+    json::Dict result;
+    result.insert({"etag"s, delta.etag});
+    result.insert({"base_version"s, escape(*request.base_version)});
+    result.insert({"added"s, to_dict(delta.added)});
+    result.insert({"changed"s, to_dict(delta.changed)});
+    json::Array removed;
+    for(const auto& key : delta.removed) {
+        removed.push_back(escape(key));
+    }
+    result.insert({"removed"s, move(removed)});
+    result.insert({"request_id", request.id});
+    return result;
+}
+
+// Ответ на запрос Map в JSON выводится напрямую, без копирования карты в json::Dict.
+// Формат совпадает с Document::StreamUpdForDict
+void JsonReader::PrintMap(MapRenderer& map, const schema::StatRequest& request,
+                          std::ostream& output) {
+    output << "{\n  "s;
+    if(auto etag = GetETag(map, request)) {
+        output << "\"etag\":\""s << *etag << "\",\n  "s;
+    }
+    output << "\"map\":\""s;
+    if(request.theme.empty()) {
+        map.PrintMap(output);
+    } else {
+        output << map.GetThemeMap(request.theme);
+    }
+    output << "\",\n  \"request_id\":"s << request.id << "}"s;
+}
+
+// Запрос MapTile задаёт либо область в географических координатах, либо тайл z/x/y
+std::string JsonReader::GetTileSvg(MapRenderer& map, const schema::StatRequest& request) {
+    renderer::Viewport viewport;
+    if(request.bounds) {
+        const schema::GeoBounds& bounds = *request.bounds;
+        viewport = map.GetBoundsViewport({bounds.min_lat, bounds.min_lng},
+                                         {bounds.max_lat, bounds.max_lng});
+    } else {
+        schema::TileCoords tile = request.tile.value_or(schema::TileCoords{});
+        viewport = map.GetTileViewport(tile.z, tile.x, tile.y);
     }
+    return map.GetTileSvg(viewport);
 }
 
-json::Dict JsonReader::GetMap(const MapRenderer& map, const json::Dict& request) {
+json::Dict JsonReader::GetMapTile(MapRenderer& map, const schema::StatRequest& request) {
     json::Dict result;
-    result.insert({"map"s, map.GetMap()});
-    result.insert({"request_id", request.at("id").AsInt()});
+    result.insert({"map"s, GetTileSvg(map, request)});
+    result.insert({"request_id", request.id});
     return result;
 }
 
-double JsonReader::GetCurvature(const domain::Bus* bus, int real_distance) {
-    double distance = 0;
+void JsonReader::PrintMapTile(MapRenderer& map, const schema::StatRequest& request,
+                              std::ostream& output) {
+    std::string svg = GetTileSvg(map, request);
 
-    for(size_t i = 1; i < bus->stops_.size(); ++i){
-        distance += ComputeDistance(
-                    bus->stops_[i-1]->coords_,
-                    bus->stops_[i]->coords_);
+    output << "{\n  \"map\":\""s;
+    json::EscapingStreambuf escaping_buf(output.rdbuf());
+    escaping_buf.sputn(svg.data(), svg.size());
+    escaping_buf.pubsync();
+    output << "\",\n  \"request_id\":"s << request.id << "}"s;
+}
+
+void JsonReader::WriteCompressedMap(MapRenderer& map, const schema::StatRequest& request,
+                                    std::streambuf* dest) {
+    compression::CompressingStreambuf compressed(dest, request.compression);
+    std::ostream out(&compressed);
+    if(request.type == schema::RequestType::MAP_TILE) {
+        std::string svg = GetTileSvg(map, request);
+        out.write(svg.data(), svg.size());
+    } else if(!request.theme.empty()) {
+        out << map.GetThemeSvg(request.theme);
+    } else {
+        map.PrintSvg(out);
+    }
+    compressed.Finish();
+}
+
+// В MessagePack сжатая карта передаётся как есть, типом bin. Длину bin нужно вывести
+// до данных, поэтому карта сначала сжимается в строку
+void JsonReader::PrintBinaryCompressedMap(MapRenderer& map, const schema::StatRequest& request,
+                                          std::ostream& output) {
+    std::string compressed;
+    {
+        json::StringStreambuf buf(compressed);
+        WriteCompressedMap(map, request, &buf);
     }
 
-    return static_cast<double>(real_distance) / distance;
+    json::Dict result;
+    if(auto etag = GetETag(map, request)) {
+        result.insert({"etag"s, *etag});
+    }
+    result.insert({"map_encoding"s, std::string(compression::GetEncodingName(request.compression))});
+    result.insert({"request_id", request.id});
+
+    // Ключи выводятся по возрастанию, как и в остальных словарях
+    msgpack::PrintDictBegin(result.size() + 1, output);
+    bool is_map_printed = false;
+    auto print_map = [&]() {
+        msgpack::Print(Document{"map"s}, output);
+        msgpack::PrintBinary(compressed, output);
+        is_map_printed = true;
+    };
+    for(const auto& [key, value] : result) {
+        if(!is_map_printed && key > "map"s) {
+            print_map();
+        }
+        msgpack::Print(Document{key}, output);
+        msgpack::Print(Document{value}, output);
+    }
+    if(!is_map_printed) {
+        print_map();
+    }
+}
+
+// В JSON сжатая карта передаётся строкой base64.
+// Формат совпадает с Document::StreamUpdForDict
+void JsonReader::PrintCompressedMap(MapRenderer& map, const schema::StatRequest& request,
+                                    std::ostream& output) {
+    output << "{\n  "s;
+    if(auto etag = GetETag(map, request)) {
+        output << "\"etag\":\""s << *etag << "\",\n  "s;
+    }
+    output << "\"map\":\""s;
+    output.flush();
+    {
+        compression::Base64Streambuf base64(output.rdbuf());
+        WriteCompressedMap(map, request, &base64);
+        base64.Finish();
+    }
+    output << "\",\n  \"map_encoding\":\""s << compression::GetEncodingName(request.compression)
+           << "\",\n  \"request_id\":"s << request.id << "}"s;
+}
+
+double JsonReader::GetCurvature(TransportCatalogue& catalog, const domain::Bus* bus,
+                                int real_distance) {
+    return static_cast<double>(real_distance) / catalog.GetGeoLength(bus);
 }
 
 json::Dict JsonReader::GetBusInfo(TransportCatalogue& catalog,
-                                  const json::Dict& request) {
+                                  const schema::StatRequest& request) {
     json::Dict result;
-    domain::Bus* bus = catalog.GetBusInfo(request.at("name"s).AsString());
+    domain::Bus* bus = catalog.GetBusInfo(request.name);
 
     if(bus) {
-        double distance = 0;
-        for(size_t i = 1; i < bus->stops_.size(); ++i) {
-            distance += catalog.GetDistance(bus->stops_[i-1], bus->stops_[i]);
-        }
+        double distance = catalog.GetRouteLength(bus);
 
-        result.insert({"curvature", GetCurvature(bus, distance)});
+        result.insert({"curvature", GetCurvature(catalog, bus, distance)});
         result.insert({"route_length", distance});
         result.insert({"stop_count", static_cast<int>(bus->stops_.size())});
 
@@ -165,15 +414,39 @@ json::Dict JsonReader::GetBusInfo(TransportCatalogue& catalog,
         result.insert({"error_message"s, "not found"s});
     }
 
-    result.insert({"request_id", request.at("id").AsInt()});
+    result.insert({"request_id", request.id});
+
+    return result;
+}
+
+json::Dict JsonReader::GetBusSegment(TransportCatalogue& catalog,
+                                     const schema::StatRequest& request) {
+    json::Dict result;
+    const domain::Bus* bus = catalog.GetBusInfo(request.name);
+
+    std::optional<RouteSegment> segment;
+    if(bus && request.from && request.to && *request.from >= 0 && *request.to >= 0) {
+        segment = catalog.GetRouteSegment(bus, *request.from, *request.to);
+    }
+
+    // Длина по дорогам - double, как и в ответе на запрос Bus
+    if(segment) {
+        result.insert({"geo_length", segment->geo_distance});
+        result.insert({"route_length", static_cast<double>(segment->road_distance)});
+        result.insert({"stop_count", static_cast<int>(segment->stop_count)});
+    } else {
+        result.insert({"error_message"s, "not found"s});
+    }
+
+    result.insert({"request_id", request.id});
 
     return result;
 }
 
 json::Dict JsonReader::GetStopInfo(TransportCatalogue& catalog,
-                                   const json::Dict& request) {
+                                   const schema::StatRequest& request) {
     json::Dict result;
-    std::optional<std::set<std::string>> stop_buses = catalog.GetStopInfo(request.at("name"s).AsString());
+    std::optional<std::set<std::string>> stop_buses = catalog.GetStopInfo(request.name);
 
     if(stop_buses) {
         json::Array data(stop_buses->size());
@@ -186,80 +459,116 @@ json::Dict JsonReader::GetStopInfo(TransportCatalogue& catalog,
         result.insert({"error_message"s, "not found"s});
     }
 
-    result.insert({"request_id", request.at("id").AsInt()});
+    result.insert({"request_id", request.id});
 
     return result;
 }
 
-void JsonReader::SetUnderLayerColor(renderer::MapRenderer& render) {
-    auto color = render_settings_.at("underlayer_color"s);
+namespace {
+
+// Цвет задаётся строкой или массивом [r, g, b] / [r, g, b, opacity]
+std::optional<svg::Color> GetColor(const json::Node& color) {
     auto color_node = color.GetNode();
     if(std::get_if<std::string>(&color_node)) {
-        render.SetUnderLayerColor(color.AsString());
-    } else if(std::get_if<Array>(&color_node)) {
-        auto arr = color.AsArray();
+        return color.AsString();
+    }
+    if(std::get_if<Array>(&color_node)) {
+        const Array& arr = color.AsArray();
         if(arr.size() == 3) {
-            svg::Rgb col(arr[0].AsInt(), arr[1].AsInt(), arr[2].AsInt());
-            render.SetUnderLayerColor(col);
-        } else if(arr.size() == 4) {
-            svg::Rgba col(arr[0].AsInt(), arr[1].AsInt(), arr[2].AsInt(), arr[3].AsDouble());
-            render.SetUnderLayerColor(col);
+            return svg::Rgb(arr[0].AsInt(), arr[1].AsInt(), arr[2].AsInt());
+        }
+        if(arr.size() == 4) {
+            return svg::Rgba(arr[0].AsInt(), arr[1].AsInt(), arr[2].AsInt(), arr[3].AsDouble());
         }
     }
+    return std::nullopt;
 }
 
-void JsonReader::SetColorPalette(renderer::MapRenderer& render) {
-    std::vector<svg::Color> palette;
-    Array color_palette = render_settings_.at("color_palette"s).AsArray();
-
-    for(const auto& item : color_palette) {
-        auto color_node = item.GetNode();
-
-        if(std::get_if<std::string>(&color_node)) {
-            palette.push_back(item.AsString());
-        } else if(std::get_if<Array>(&color_node)) {
-           auto arr = item.AsArray();
-           if(arr.size() == 3) {
-               svg::Rgb col(arr[0].AsInt(), arr[1].AsInt(), arr[2].AsInt());
-               palette.push_back(col);
-           } else if(arr.size() == 4) {
-               svg::Rgba col(arr[0].AsInt(), arr[1].AsInt(), arr[2].AsInt(), arr[3].AsDouble());
-               palette.push_back(col);
-           }
-        }
+std::vector<double> GetOffset(const json::Node& offset) {
+    std::vector<double> result;
+    for(const auto& item : offset.AsArray()) {
+        result.push_back(item.AsDouble());
     }
+    return result;
+}
 
-    render.SetColorPalette(palette);
 }
 
-void JsonReader::SetSetRenderSettings(renderer::MapRenderer& render) {
-    if(json_data_.find("render_settings"s) == json_data_.end()) {
-        return;
+// Отсутствующие в settings параметры не меняются: тема наследует их у основного оформления
+template <typename Style>
+void JsonReader::SetStyleSettings(Style& style, const json::Dict& settings) {
+    if(auto it = settings.find("bus_label_font_size"s); it != settings.end()) {
+        style.SetBusFontSize(it->second.AsInt());
+    }
+    if(auto it = settings.find("line_width"s); it != settings.end()) {
+        style.SetLineWidth(it->second.AsDouble());
+    }
+    if(auto it = settings.find("stop_label_font_size"s); it != settings.end()) {
+        style.SetStopFontSize(it->second.AsInt());
     }
+    if(auto it = settings.find("underlayer_width"s); it != settings.end()) {
+        style.SetUnderlayerWidth(it->second.AsDouble());
+    }
+    if(auto it = settings.find("stop_radius"s); it != settings.end()) {
+        style.StopRadius(it->second.AsDouble());
+    }
+    if(auto it = settings.find("stop_label_offset"s); it != settings.end()) {
+        style.SetStopLabelOffset(GetOffset(it->second));
+    }
+    if(auto it = settings.find("bus_label_offset"s); it != settings.end()) {
+        style.SetBusLabelOffset(GetOffset(it->second));
+    }
+    if(auto it = settings.find("underlayer_color"s); it != settings.end()) {
+        if(auto color = GetColor(it->second)) {
+            style.SetUnderLayerColor(*color);
+        }
+    }
+    if(auto it = settings.find("color_palette"s); it != settings.end()) {
+        renderer::ColorArray palette;
+        for(const auto& item : it->second.AsArray()) {
+            if(auto color = GetColor(item)) {
+                palette.push_back(*color);
+            }
+        }
+        style.SetColorPalette(palette);
+    }
+}
 
-    render_settings_ = json_data_.at("render_settings"s).AsMap();
+void JsonReader::SetSetRenderSettings(renderer::MapRenderer& render,
+                                      const json::Dict& render_settings) {
+    render.SetWidth(render_settings.at("width"s).AsDouble());
+    render.SetHeight(render_settings.at("height"s).AsDouble());
+    render.SetPadding(render_settings.at("padding"s).AsDouble());
 
-    render.SetWidth(render_settings_.at("width"s).AsDouble());
-    render.SetHeight(render_settings_.at("height"s).AsDouble());
-    render.SetBusFontSize(render_settings_.at("bus_label_font_size"s).AsInt());
-    render.SetLineWidth(render_settings_.at("line_width"s).AsDouble());
+    SetStyleSettings(render, render_settings);
 
-    render.SetPadding(render_settings_.at("padding"s).AsDouble());
-    render.SetStopFontSize(render_settings_.at("stop_label_font_size"s).AsInt());
-    render.SetUnderlayerWidth(render_settings_.at("underlayer_width"s).AsDouble());
-    render.StopRadius(render_settings_.at("stop_radius"s).AsDouble());
+    // Темы: {"название": {параметры оформления}}, геометрия у всех тем общая
+    if(auto it = render_settings.find("themes"s); it != render_settings.end()) {
+        for(const auto& [name, theme_settings] : it->second.AsMap()) {
+            renderer::RenderStyle style = render.GetStyle();
+            SetStyleSettings(style, theme_settings.AsMap());
+            render.AddTheme(name, style);
+        }
+    }
 
-    auto stop_offset_arr = render_settings_.at("stop_label_offset"s).AsArray();
-    if(stop_offset_arr.size() == 2) {
-        render.SetStopLabelOffset({stop_offset_arr[0].AsDouble(), stop_offset_arr[1].AsDouble()});
+    if(auto it = render_settings.find("lod_tolerance"s); it != render_settings.end()) {
+        render.SetLodTolerance(it->second.AsDouble());
     }
 
-    auto bus_offset_arr = render_settings_.at("bus_label_offset"s).AsArray();
-    if(bus_offset_arr.size() == 2) {
-        render.SetBusLabelOffset({bus_offset_arr[0].AsDouble(), bus_offset_arr[1].AsDouble()});
+    if(auto it = render_settings.find("avoid_label_collisions"s); it != render_settings.end()) {
+        render.SetLabelPlacement(it->second.AsBool());
     }
 
-    SetUnderLayerColor(render);
-    SetColorPalette(render);
+    if(auto it = render_settings.find("compact_output"s); it != render_settings.end()) {
+        svg::CompactOptions options;
+        const json::Dict& compact = it->second.AsMap();
+        if(auto precision = compact.find("precision"s); precision != compact.end()) {
+            options.precision = precision->second.AsInt();
+        }
+        if(auto use_paths = compact.find("use_paths"s); use_paths != compact.end()) {
+            options.use_paths = use_paths->second.AsBool();
+        }
+        render.SetCompactOutput(options);
+    }
 }
 
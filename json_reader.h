@@ -4,36 +4,76 @@
 #include "svg.h"
 #include "transport_catalogue.h"
 #include "map_renderer.h"
+#include "request_schema.h"
 
 /*
  * Здесь можно разместить код наполнения транспортного справочника данными из JSON,
  * а также код обработки запросов к базе и формирование массива ответов в формате JSON
  */
 
+enum class DataFormat {
+    AUTO,
+    JSON,
+    MSGPACK,
+};
+
 class JsonReader {
 public:
+    // AUTO для входных данных определяет формат по первому байту потока,
+    // для ответов - повторяет формат входных данных
+    void SetInputFormat(DataFormat format);
+    void SetOutputFormat(DataFormat format);
+
+    // Входной документ освобождается сразу после заполнения справочника и настроек карты,
+    // сохраняются только разобранные запросы stat_requests
     void SetData(transport_list::TransportCatalogue& catalog,
                  renderer::MapRenderer& render,
                  std::istream& input);
 
-    json::Array GetData(transport_list::TransportCatalogue& catalog,
-                        renderer::MapRenderer& render);
+    // Обрабатывает запросы по одному и сразу выводит ответы в output
+    void GetData(transport_list::TransportCatalogue& catalog,
+                 renderer::MapRenderer& render,
+                 std::ostream& output);
 
 private:
-    json::Dict json_data_;
-    json::Array input_requests_;
-    json::Array output_requests_;
-    json::Dict render_settings_;
-
-    void SetStops(transport_list::TransportCatalogue& catalog);
-    void SetBuses(transport_list::TransportCatalogue& catalog);
-    void SetDistances(transport_list::TransportCatalogue& catalog);
-    void SetSetRenderSettings(renderer::MapRenderer& render);
-    void SetColorPalette(renderer::MapRenderer& render);
-    void SetUnderLayerColor(renderer::MapRenderer& render);
-
-    json::Dict GetBusInfo(transport_list::TransportCatalogue& catalog, const json::Dict& request);
-    json::Dict GetStopInfo(transport_list::TransportCatalogue& catalog, const json::Dict& request);
-    json::Dict GetMap(const renderer::MapRenderer& map, const json::Dict& request);
-    double GetCurvature(const domain::Bus* bus, int real_distance);
+    DataFormat input_format_ = DataFormat::AUTO;
+    DataFormat output_format_ = DataFormat::AUTO;
+    DataFormat response_format_ = DataFormat::JSON;
+
+    std::optional<std::vector<schema::StatRequest>> stat_requests_;
+
+    void SetStops(transport_list::TransportCatalogue& catalog,
+                  const std::vector<schema::StopRequest>& stops);
+    void SetBuses(transport_list::TransportCatalogue& catalog,
+                  const std::vector<schema::BusRequest>& buses);
+    void SetDistances(transport_list::TransportCatalogue& catalog,
+                      const std::vector<schema::StopRequest>& stops);
+    void SetSetRenderSettings(renderer::MapRenderer& render, const json::Dict& render_settings);
+    // Style - MapRenderer или RenderStyle темы, у них одинаковые методы оформления
+    template <typename Style>
+    void SetStyleSettings(Style& style, const json::Dict& settings);
+
+    json::Dict GetBusInfo(transport_list::TransportCatalogue& catalog, const schema::StatRequest& request);
+    json::Dict GetStopInfo(transport_list::TransportCatalogue& catalog, const schema::StatRequest& request);
+    json::Dict GetBusSegment(transport_list::TransportCatalogue& catalog, const schema::StatRequest& request);
+    // ETag выдаётся на запросы Map с полем if_none_match или base_version
+    std::optional<std::string> GetETag(const renderer::MapRenderer& map, const schema::StatRequest& request);
+    bool IsNotModified(const renderer::MapRenderer& map, const schema::StatRequest& request);
+    json::Dict GetMap(renderer::MapRenderer& map, const schema::StatRequest& request);
+    json::Dict GetMapDelta(const renderer::MapDelta& delta, const schema::StatRequest& request);
+    void PrintMap(renderer::MapRenderer& map, const schema::StatRequest& request,
+                  std::ostream& output);
+    std::string GetTileSvg(renderer::MapRenderer& map, const schema::StatRequest& request);
+    json::Dict GetMapTile(renderer::MapRenderer& map, const schema::StatRequest& request);
+    void PrintMapTile(renderer::MapRenderer& map, const schema::StatRequest& request,
+                      std::ostream& output);
+    // Сжатая карта. Сжатие идёт в отдельном потоке одновременно с построением карты
+    void WriteCompressedMap(renderer::MapRenderer& map, const schema::StatRequest& request,
+                            std::streambuf* dest);
+    void PrintBinaryCompressedMap(renderer::MapRenderer& map, const schema::StatRequest& request,
+                                  std::ostream& output);
+    void PrintCompressedMap(renderer::MapRenderer& map, const schema::StatRequest& request,
+                            std::ostream& output);
+    double GetCurvature(transport_list::TransportCatalogue& catalog, const domain::Bus* bus,
+                        int real_distance);
 };
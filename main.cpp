@@ -1,6 +1,8 @@
 #include <fstream>
 #include <sstream>
+#include <string_view>
 
+#include "compression.h"
 #include "json_reader.h"
 #include "transport_catalogue.h"
 #include "request_handler.h"
@@ -14,12 +16,46 @@ json::Document LoadJSON(const std::string& s) {
     return json::Load(strm);
 }
 
-int main() {
+DataFormat ParseFormat(std::string_view format) {
+    using namespace std::string_view_literals;
+    if(format == "json"sv) {
+        return DataFormat::JSON;
+    }
+    if(format == "msgpack"sv) {
+        return DataFormat::MSGPACK;
+    }
+    return DataFormat::AUTO;
+}
+
+int main(int argc, char* argv[]) {
+    using namespace std::string_view_literals;
     JsonReader json_reader;
+
     TransportCatalogue catalog;
     MapRenderer render;
+
+    // --input=json|msgpack, --output=json|msgpack; по умолчанию формат входа
+    // определяется по первому байту, а ответы выводятся в том же формате.
+    // --stream-map: карта в JSON-ответах выводится по мере построения, без кэширования.
+    // --compress=gzip|deflate: весь вывод сжимается.
+    // --compact-coordinates: координаты остановок хранятся с фиксированной точкой (шаг около 1 см)
+    std::optional<compression::Encoding> output_encoding;
+    for(int i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if(arg.substr(0, 8) == "--input="sv) {
+            json_reader.SetInputFormat(ParseFormat(arg.substr(8)));
+        } else if(arg.substr(0, 9) == "--output="sv) {
+            json_reader.SetOutputFormat(ParseFormat(arg.substr(9)));
+        } else if(arg == "--stream-map"sv) {
+            render.SetStreaming(true);
+        } else if(arg.substr(0, 11) == "--compress="sv) {
+            output_encoding = compression::ParseEncoding(arg.substr(11));
+        } else if(arg == "--compact-coordinates"sv) {
+            catalog.SetCompactCoordinates(true);
+        }
+    }
    // RequestHandler request(catalog, render);
-    std::ifstream in("E:\\VADIM\\Qt\\practicum_5_14_1_transport_catalogue_visualisation\\write3.json");
+    std::ifstream in("E:\\VADIM\\Qt\\practicum_5_14_1_transport_catalogue_visualisation\\write3.json", std::ios::binary);
 
     if (in.is_open())
     {
@@ -31,7 +67,14 @@ int main() {
     in.close();
 
     render.SetMap(catalog);
-    json_reader.GetData(catalog, render);
+    if(output_encoding && *output_encoding != compression::Encoding::NONE) {
+        compression::CompressingStreambuf compressed(std::cout.rdbuf(), *output_encoding);
+        std::ostream out(&compressed);
+        json_reader.GetData(catalog, render, out);
+        compressed.Finish();
+    } else {
+        json_reader.GetData(catalog, render, std::cout);
+    }
 
 
     /*
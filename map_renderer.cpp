@@ -1,4 +1,17 @@
+#include <cmath>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <future>
+#include <thread>
+#include <tuple>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "map_renderer.h"
+#include "json.h"
 
 /*
  * В этом файле вы можете разместить код, отвечающий за визуализацию карты маршрутов в формате SVG.
@@ -11,6 +24,235 @@ using namespace domain;
 
 namespace renderer {
 
+namespace {
+
+#ifdef __SSE2__
+// В SSE2 нет сравнения целых по минимуму и максимуму, поэтому через маску
+__m128i MinInt32(__m128i lhs, __m128i rhs) {
+    __m128i greater = _mm_cmpgt_epi32(lhs, rhs);
+    return _mm_or_si128(_mm_and_si128(greater, rhs), _mm_andnot_si128(greater, lhs));
+}
+
+__m128i MaxInt32(__m128i lhs, __m128i rhs) {
+    __m128i greater = _mm_cmpgt_epi32(lhs, rhs);
+    return _mm_or_si128(_mm_and_si128(greater, lhs), _mm_andnot_si128(greater, rhs));
+}
+
+std::pair<int32_t, int32_t> GetMinMax(__m128i min4, __m128i max4) {
+    int32_t values[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(values), min4);
+    int32_t min = *std::min_element(values, values + 4);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(values), max4);
+    int32_t max = *std::max_element(values, values + 4);
+    return {min, max};
+}
+#endif
+
+// Координаты остановок в порядке stops. Массив любого вида, в нём по номерам остановок
+template <typename CoordinatesArray>
+CoordinatesArray GatherCoordinates(const CoordinatesArray& all_coords,
+                                   const std::vector<const Stop*>& stops) {
+    CoordinatesArray result;
+    result.lat.reserve(stops.size());
+    result.lng.reserve(stops.size());
+    for(const Stop* stop : stops) {
+        result.lat.push_back(all_coords.lat[stop->id_]);
+        result.lng.push_back(all_coords.lng[stop->id_]);
+    }
+    return result;
+}
+
+}
+
+SphereProjector::SphereProjector(const geo::CoordinatesArray& points, double max_width,
+                                 double max_height, double padding)
+    : offset_x_(padding)
+    , offset_y_(padding) {
+    size_t size = points.Size();
+    if(size == 0) {
+        return;
+    }
+
+    const double* lat = points.lat.data();
+    const double* lng = points.lng.data();
+    double min_lon = lng[0];
+    double max_lon = lng[0];
+    double min_lat = lat[0];
+    double max_lat = lat[0];
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Минимумы и максимумы по двум точкам за шаг, затем свёртка пар
+    if(size >= 2) {
+        __m128d min_lon2 = _mm_loadu_pd(lng);
+        __m128d max_lon2 = min_lon2;
+        __m128d min_lat2 = _mm_loadu_pd(lat);
+        __m128d max_lat2 = min_lat2;
+        for(i = 2; i + 2 <= size; i += 2) {
+            __m128d lng2 = _mm_loadu_pd(lng + i);
+            __m128d lat2 = _mm_loadu_pd(lat + i);
+            min_lon2 = _mm_min_pd(min_lon2, lng2);
+            max_lon2 = _mm_max_pd(max_lon2, lng2);
+            min_lat2 = _mm_min_pd(min_lat2, lat2);
+            max_lat2 = _mm_max_pd(max_lat2, lat2);
+        }
+
+        double pair[2];
+        _mm_storeu_pd(pair, min_lon2);
+        min_lon = std::min(pair[0], pair[1]);
+        _mm_storeu_pd(pair, max_lon2);
+        max_lon = std::max(pair[0], pair[1]);
+        _mm_storeu_pd(pair, min_lat2);
+        min_lat = std::min(pair[0], pair[1]);
+        _mm_storeu_pd(pair, max_lat2);
+        max_lat = std::max(pair[0], pair[1]);
+    }
+#endif
+
+    for(; i < size; ++i) {
+        min_lon = std::min(min_lon, lng[i]);
+        max_lon = std::max(max_lon, lng[i]);
+        min_lat = std::min(min_lat, lat[i]);
+        max_lat = std::max(max_lat, lat[i]);
+    }
+
+    SetBounds(min_lon, max_lon, min_lat, max_lat, max_width, max_height, padding);
+}
+
+SphereProjector::SphereProjector(const geo::FixedCoordinatesArray& points, double max_width,
+                                 double max_height, double padding)
+    : offset_x_(padding)
+    , offset_y_(padding) {
+    size_t size = points.Size();
+    if(size == 0) {
+        return;
+    }
+
+    const int32_t* lat = points.lat.data();
+    const int32_t* lng = points.lng.data();
+    int32_t min_lon = lng[0];
+    int32_t max_lon = lng[0];
+    int32_t min_lat = lat[0];
+    int32_t max_lat = lat[0];
+    size_t i = 0;
+
+#ifdef __SSE2__
+    if(size >= 4) {
+        __m128i min_lon4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lng));
+        __m128i max_lon4 = min_lon4;
+        __m128i min_lat4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lat));
+        __m128i max_lat4 = min_lat4;
+        for(i = 4; i + 4 <= size; i += 4) {
+            __m128i lng4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lng + i));
+            __m128i lat4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lat + i));
+            min_lon4 = MinInt32(min_lon4, lng4);
+            max_lon4 = MaxInt32(max_lon4, lng4);
+            min_lat4 = MinInt32(min_lat4, lat4);
+            max_lat4 = MaxInt32(max_lat4, lat4);
+        }
+        std::tie(min_lon, max_lon) = GetMinMax(min_lon4, max_lon4);
+        std::tie(min_lat, max_lat) = GetMinMax(min_lat4, max_lat4);
+    }
+#endif
+
+    for(; i < size; ++i) {
+        min_lon = std::min(min_lon, lng[i]);
+        max_lon = std::max(max_lon, lng[i]);
+        min_lat = std::min(min_lat, lat[i]);
+        max_lat = std::max(max_lat, lat[i]);
+    }
+
+    // Перевод в double сохраняет порядок, поэтому границы те же, что и у переведённых точек
+    SetBounds(geo::FromFixed(min_lon), geo::FromFixed(max_lon),
+              geo::FromFixed(min_lat), geo::FromFixed(max_lat), max_width, max_height, padding);
+}
+
+void SphereProjector::SetBounds(double min_lon, double max_lon, double min_lat, double max_lat,
+                                double max_width, double max_height, double padding) {
+    min_lon_ = min_lon;
+    max_lat_ = max_lat;
+
+    std::optional<double> width_zoom;
+    if (!IsZero(max_lon - min_lon_)) {
+        width_zoom = (max_width - 2 * padding) / (max_lon - min_lon_);
+    }
+
+    std::optional<double> height_zoom;
+    if (!IsZero(max_lat_ - min_lat)) {
+        height_zoom = (max_height - 2 * padding) / (max_lat_ - min_lat);
+    }
+
+    if (width_zoom && height_zoom) {
+        zoom_coeff_ = std::min(*width_zoom, *height_zoom);
+    } else if (width_zoom) {
+        zoom_coeff_ = *width_zoom;
+    } else if (height_zoom) {
+        zoom_coeff_ = *height_zoom;
+    }
+}
+
+std::vector<svg::Point> SphereProjector::Project(const geo::CoordinatesArray& points) const {
+    size_t size = points.Size();
+    const double* lat = points.lat.data();
+    const double* lng = points.lng.data();
+    std::vector<svg::Point> result(size);
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Те же операции, что и в operator(), без FMA, поэтому результат совпадает побитово
+    static_assert(sizeof(svg::Point) == 2 * sizeof(double));
+    const __m128d min_lon = _mm_set1_pd(min_lon_);
+    const __m128d max_lat = _mm_set1_pd(max_lat_);
+    const __m128d zoom = _mm_set1_pd(zoom_coeff_);
+    const __m128d offset_x = _mm_set1_pd(offset_x_);
+    const __m128d offset_y = _mm_set1_pd(offset_y_);
+    for(; i + 2 <= size; i += 2) {
+        __m128d x = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(lng + i), min_lon), zoom), offset_x);
+        __m128d y = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(max_lat, _mm_loadu_pd(lat + i)), zoom), offset_y);
+        _mm_storeu_pd(&result[i].x, _mm_unpacklo_pd(x, y));
+        _mm_storeu_pd(&result[i + 1].x, _mm_unpackhi_pd(x, y));
+    }
+#endif
+
+    for(; i < size; ++i) {
+        result[i] = (*this)({lat[i], lng[i]});
+    }
+    return result;
+}
+
+std::vector<svg::Point> SphereProjector::Project(const geo::FixedCoordinatesArray& points) const {
+    size_t size = points.Size();
+    const int32_t* lat = points.lat.data();
+    const int32_t* lng = points.lng.data();
+    std::vector<svg::Point> result(size);
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Перевод int32 в double точный, а деление - то же, что и в geo::FromFixed
+    const __m128d scale = _mm_set1_pd(geo::FIXED_POINT_SCALE);
+    const __m128d min_lon = _mm_set1_pd(min_lon_);
+    const __m128d max_lat = _mm_set1_pd(max_lat_);
+    const __m128d zoom = _mm_set1_pd(zoom_coeff_);
+    const __m128d offset_x = _mm_set1_pd(offset_x_);
+    const __m128d offset_y = _mm_set1_pd(offset_y_);
+    for(; i + 2 <= size; i += 2) {
+        __m128d lng2 = _mm_div_pd(_mm_cvtepi32_pd(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(lng + i))), scale);
+        __m128d lat2 = _mm_div_pd(_mm_cvtepi32_pd(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(lat + i))), scale);
+        __m128d x = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(lng2, min_lon), zoom), offset_x);
+        __m128d y = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(max_lat, lat2), zoom), offset_y);
+        _mm_storeu_pd(&result[i].x, _mm_unpacklo_pd(x, y));
+        _mm_storeu_pd(&result[i + 1].x, _mm_unpackhi_pd(x, y));
+    }
+#endif
+
+    for(; i < size; ++i) {
+        result[i] = (*this)(points.Get(i));
+    }
+    return result;
+}
+
 template <typename T>
 void SetParametr(T& param, T new_param) {
    if(new_param >= 0 && new_param <= 100000) {
@@ -19,69 +261,199 @@ void SetParametr(T& param, T new_param) {
 }
 
 void MapRenderer::SetWidth(double width) {
+    ++settings_version_;
+    ++layout_version_;
     SetParametr(width_, width);
 }
 
 void MapRenderer::SetHeight(double height) {
+    ++settings_version_;
+    ++layout_version_;
     SetParametr(height_, height);
 }
 
 void MapRenderer::SetPadding(double padding) {
+    ++settings_version_;
+    ++layout_version_;
     double max_size = std::min(width_, height_)/2;
     if(padding >= 0 && padding < max_size) {
         padding_ = padding;
     }
 }
 
+namespace {
+
+bool IsValidOffset(const std::vector<double>& params) {
+    return params.size() == 2 && std::all_of(params.begin(), params.end(), [](double i) {
+        return i > -100000 && i <= 100000;
+    });
+}
+
+}
+
+void RenderStyle::SetLineWidth(double width) {
+    SetParametr(line_width, width);
+}
+
+void RenderStyle::StopRadius(double radius) {
+    SetParametr(stop_radius, radius);
+}
+
+void RenderStyle::SetBusFontSize(int font_size) {
+    SetParametr(bus_label_font_size, font_size);
+}
+
+void RenderStyle::SetStopFontSize(int font_size) {
+    SetParametr(stop_label_font_size, font_size);
+}
+
+void RenderStyle::SetUnderlayerWidth(double width) {
+    SetParametr(underlayer_width, width);
+}
+
+void RenderStyle::SetBusLabelOffset(const std::vector<double>& params) {
+    if(IsValidOffset(params)) {
+        bus_label_offset = params;
+    }
+}
+
+void RenderStyle::SetStopLabelOffset(const std::vector<double>& params) {
+    if(IsValidOffset(params)) {
+        stop_label_offset = params;
+    }
+}
+
+void RenderStyle::SetUnderLayerColor(const svg::Color& color) {
+    underlayer_color = color;
+}
+
+void RenderStyle::SetColorPalette(const ColorArray& color_arr) {
+    color_palette = color_arr;
+}
+
 void MapRenderer::SetLineWidth(double line_width) {
-    SetParametr(line_width_, line_width);
+    ++settings_version_;
+    style_.SetLineWidth(line_width);
 }
 
 void MapRenderer::StopRadius(double stop_radius) {
-    SetParametr(stop_radius_, stop_radius);
+    ++settings_version_;
+    style_.StopRadius(stop_radius);
 }
 
 void MapRenderer::SetBusFontSize(int font_size) {
-    SetParametr(bus_label_font_size_, font_size);
+    ++settings_version_;
+    style_.SetBusFontSize(font_size);
 }
 
 void MapRenderer::SetStopFontSize(int font_size) {
-    SetParametr(stop_label_font_size_, font_size);
+    ++settings_version_;
+    style_.SetStopFontSize(font_size);
 }
 
 void MapRenderer::SetUnderlayerWidth(double width) {
-    SetParametr(underlayer_width_, width);
+    ++settings_version_;
+    style_.SetUnderlayerWidth(width);
 }
 
 void MapRenderer::SetBusLabelOffset(const std::vector<double>& params) {
-    for(auto i : params) {
-        if(i > -100000 && i <= 100000) {
-            bus_label_offset_.push_back(i);
-        }
-    }
+    ++settings_version_;
+    style_.SetBusLabelOffset(params);
 }
 
 void MapRenderer::SetStopLabelOffset(const std::vector<double>& params) {
-    for(auto i : params) {
-        if(i > -100000 && i <= 100000) {
-            stop_label_offset_.push_back(i);
-        }
-    }
+    ++settings_version_;
+    style_.SetStopLabelOffset(params);
 }
 
 void MapRenderer::SetUnderLayerColor(const svg::Color& color) {
-    underlayer_color_ = color;
+    ++settings_version_;
+    style_.SetUnderLayerColor(color);
 }
 
 void MapRenderer::SetColorPalette(const ColorArray& color_arr) {
-    color_palette_ = color_arr;
+    ++settings_version_;
+    ++layout_version_;
+    style_.SetColorPalette(color_arr);
+}
+
+void MapRenderer::SetCompactOutput(const svg::CompactOptions& options) {
+    ++settings_version_;
+    compact_output_ = options;
+}
+
+void MapRenderer::SetLodTolerance(double tolerance) {
+    ++layout_version_;
+    SetParametr(lod_tolerance_, tolerance);
+}
+
+const RenderStyle& MapRenderer::GetStyle() const {
+    return style_;
+}
+
+void MapRenderer::AddTheme(const std::string& name, const RenderStyle& style) {
+    themes_[name] = Theme{style, std::nullopt};
+}
+
+bool MapRenderer::HasTheme(const std::string& name) const {
+    return themes_.count(name) > 0;
+}
+
+namespace {
+
+void AddColor(domain::detail::ContentHasher& hasher, const svg::Color& color) {
+    std::ostringstream out;
+    std::visit(svg::SolutionPrinter{out}, color);
+    hasher.AddString(out.str());
+}
+
+}
+
+std::string MapRenderer::GetETag(const std::string& theme) const {
+    domain::detail::ContentHasher hasher;
+    hasher.AddValue(catalog_ ? catalog_->GetContentHash() : 0)
+            .AddValue(width_)
+            .AddValue(height_)
+            .AddValue(padding_)
+            .AddValue(avoid_label_collisions_)
+            .AddValue(compact_output_.has_value());
+    if(compact_output_) {
+        hasher.AddValue(compact_output_->precision).AddValue(compact_output_->use_paths);
+    }
+
+    const RenderStyle& style = theme.empty() ? style_ : themes_.at(theme).style;
+    hasher.AddString(theme)
+            .AddValue(style.stop_radius)
+            .AddValue(style.line_width)
+            .AddValue(style.underlayer_width)
+            .AddValue(style.bus_label_font_size)
+            .AddValue(style.stop_label_font_size);
+    for(double offset : style.bus_label_offset) {
+        hasher.AddValue(offset);
+    }
+    for(double offset : style.stop_label_offset) {
+        hasher.AddValue(offset);
+    }
+    AddColor(hasher, style.underlayer_color);
+    for(const auto& color : style.color_palette) {
+        AddColor(hasher, color);
+    }
+
+    std::ostringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0') << hasher.Get();
+    return out.str();
+}
+
+void MapRenderer::SetLabelPlacement(bool avoid_collisions) {
+    ++settings_version_;
+    avoid_label_collisions_ = avoid_collisions;
 }
 
 svg::Polyline MapRenderer::CreateBusLine(const Bus* bus,
-                                         const SphereProjector& projector) {
+                                         const StopPoints& points) const {
     svg::Polyline polyline;
     for(const auto& stop : bus->stops_) {
-        polyline.AddPoint(projector(stop->coords_));
+        polyline.AddPoint(points[stop->id_]);
     }
     return polyline;
 }
@@ -93,7 +465,7 @@ std::vector<double> GetSortLatItems(const std::unordered_map<std::string_view,
                    stops.end(),
                    lat_items.begin(),
                    [](const auto& item){
-                        return item.second->coords_.lat;
+                        return item.second->GetCoordinates().lat;
                     }
                 );
 
@@ -108,7 +480,7 @@ std::vector<double> GetSortLonItems(const std::unordered_map<std::string_view,
                    stops.end(),
                    lon_items.begin(),
                    [](const auto& item){
-                        return item.second->coords_.lng;
+                        return item.second->GetCoordinates().lng;
                     }
                 );
 
@@ -116,192 +488,898 @@ std::vector<double> GetSortLonItems(const std::unordered_map<std::string_view,
     return lon_items;
 }
 
-svg::Text MapRenderer::GetUnderlayerTextBus(const Bus* bus,
-                                         const Stop* stop,
-                                            const SphereProjector& projector) {
+svg::Text MapRenderer::GetUnderlayerTextBus(const RenderStyle& style, const Bus* bus,
+                                            svg::Point point) const {
     using namespace std::string_literals;
     return svg::Text()
             .SetData(bus->title_)
-            .SetFillColor(underlayer_color_)
-            .SetStrokeColor(underlayer_color_)
-            .SetStrokeWidth(underlayer_width_)
+            .SetFillColor(style.underlayer_color)
+            .SetStrokeColor(style.underlayer_color)
+            .SetStrokeWidth(style.underlayer_width)
             .SetStrokeLineCap(svg::StrokeLineCap::ROUND)
             .SetStrokeLineJoin(svg::StrokeLineJoin::ROUND)
-            .SetPosition(projector(stop->coords_))
-            .SetOffset({bus_label_offset_[0], bus_label_offset_[1]})
-            .SetFontSize(bus_label_font_size_)
+            .SetPosition(point)
+            .SetOffset({style.bus_label_offset[0], style.bus_label_offset[1]})
+            .SetFontSize(style.bus_label_font_size)
             .SetFontFamily("Verdana"s)
             .SetFontWeight("bold"s);
 }
 
-svg::Text MapRenderer::GetTextBus(const Bus* bus,
-                  const Stop* stop, size_t color_count,
-                                  const SphereProjector& projector) {
+svg::Text MapRenderer::GetTextBus(const RenderStyle& style, const Bus* bus, size_t color_count,
+                                  svg::Point point) const {
     using namespace std::string_literals;
     return svg::Text()
-            .SetFontSize(bus_label_font_size_)
+            .SetFontSize(style.bus_label_font_size)
             .SetData(bus->title_)
-            .SetPosition(projector(stop->coords_))
-            .SetOffset({bus_label_offset_[0], bus_label_offset_[1]})
+            .SetPosition(point)
+            .SetOffset({style.bus_label_offset[0], style.bus_label_offset[1]})
             .SetFontFamily("Verdana"s)
             .SetFontWeight("bold"s)
-            .SetFillColor(color_palette_[color_count]);
+            .SetFillColor(style.color_palette[color_count]);
 }
 
-svg::Text MapRenderer::GetUnderlayerTextStop(const Stop* stop,
-                                             const SphereProjector& projector) {
+svg::Text MapRenderer::GetUnderlayerTextStop(const RenderStyle& style, const Stop* stop,
+                                             svg::Point point) const {
     using namespace std::string_literals;
     return svg::Text()
-            .SetFontSize(stop_label_font_size_)
-            .SetData(stop->title_)
-            .SetPosition(projector(stop->coords_))
-            .SetOffset({stop_label_offset_[0], stop_label_offset_[1]})
+            .SetFontSize(style.stop_label_font_size)
+            .SetData(std::string(stop->GetTitle()))
+            .SetPosition(point)
+            .SetOffset({style.stop_label_offset[0], style.stop_label_offset[1]})
             .SetFontFamily("Verdana"s)
             .SetStrokeLineJoin(svg::StrokeLineJoin::ROUND)
             .SetStrokeLineCap(svg::StrokeLineCap::ROUND)
-            .SetStrokeWidth(underlayer_width_)
-            .SetStrokeColor(underlayer_color_)
-            .SetFillColor(underlayer_color_);
+            .SetStrokeWidth(style.underlayer_width)
+            .SetStrokeColor(style.underlayer_color)
+            .SetFillColor(style.underlayer_color);
 }
 
-svg::Text MapRenderer::GetTextStop(const Stop* stop,
-                                   const SphereProjector& projector) {
+svg::Text MapRenderer::GetTextStop(const RenderStyle& style, const Stop* stop,
+                                   svg::Point point) const {
     using namespace std::string_literals;
     return svg::Text()
-            .SetFontSize(stop_label_font_size_)
-            .SetData(stop->title_)
-            .SetPosition(projector(stop->coords_))
-            .SetOffset({stop_label_offset_[0], stop_label_offset_[1]})
+            .SetFontSize(style.stop_label_font_size)
+            .SetData(std::string(stop->GetTitle()))
+            .SetPosition(point)
+            .SetOffset({style.stop_label_offset[0], style.stop_label_offset[1]})
             .SetFontFamily("Verdana"s)
             .SetFillColor("black"s);
 }
 
-void MapRenderer::SetBuses(const std::map<std::string_view, Bus*> buses,
-                           const SphereProjector& projector) {
+svg::Polyline& MapRenderer::SetBusLineStyle(svg::Polyline& polyline, const RenderStyle& style,
+                                            size_t color) const {
     using namespace std::string_literals;
-    size_t color_count = 0;
-    for(const auto& bus : buses) {
-        if(bus.second->stops_.empty()) {
+    return polyline
+            .SetStrokeLineJoin(svg::StrokeLineJoin::ROUND)
+            .SetStrokeLineCap(svg::StrokeLineCap::ROUND)
+            .SetFillColor("none"s)
+            .SetStrokeColor(style.color_palette[color])
+            .SetStrokeWidth(style.line_width);
+}
+
+void MapRenderer::AddBusLine(svg::ObjectContainer& container, const RenderStyle& style,
+                             const BusColor& bus, const StopPoints& points) const {
+    svg::Polyline polyline = CreateBusLine(bus.first, points);
+    container.Add(std::move(SetBusLineStyle(polyline, style, bus.second)));
+}
+
+void MapRenderer::AddClippedBusLine(svg::ObjectContainer& container, const RenderStyle& style,
+                                    const std::vector<svg::Point>& line, size_t color,
+                                    const spatial::Rect& clip) const {
+    std::vector<svg::Point> part;
+    auto flush = [&] {
+        if(!part.empty()) {
+            svg::Polyline polyline;
+            for(const auto& point : part) {
+                polyline.AddPoint(point);
+            }
+            container.Add(std::move(SetBusLineStyle(polyline, style, color)));
+            part.clear();
+        }
+    };
+
+    if(line.size() == 1 && clip.Contains(line.front())) {
+        part.push_back(line.front());
+    }
+
+    // Ломаная разрывается там, где отрезок выходит за clip
+    for(size_t i = 1; i < line.size(); ++i) {
+        svg::Point from = line[i - 1];
+        svg::Point to = line[i];
+
+        if(!spatial::ClipSegment(clip, from, to)) {
+            flush();
             continue;
         }
+        if(part.empty() || from.x != part.back().x || from.y != part.back().y) {
+            flush();
+            part.push_back(from);
+        }
+        part.push_back(to);
+        if(to.x != line[i].x || to.y != line[i].y) {
+            flush();
+        }
+    }
+    flush();
+}
+
+void MapRenderer::AddBusLabelAt(svg::ObjectContainer& container, const RenderStyle& style,
+                                const BusColor& bus, svg::Point point) const {
+    container.Add(GetUnderlayerTextBus(style, bus.first, point));
+    container.Add(GetTextBus(style, bus.first, bus.second, point));
+}
+
+void MapRenderer::AddBusLabel(svg::ObjectContainer& container, const RenderStyle& style,
+                              const BusColor& bus, const BusLabelAnchors& anchors) const {
+    AddBusLabelAt(container, style, bus, anchors.start);
+    if(anchors.last) {
+        AddBusLabelAt(container, style, bus, *anchors.last);
+    }
+}
+
+void MapRenderer::AddStopCircle(svg::ObjectContainer& container, const RenderStyle& style,
+                                svg::Point point) const {
+    using namespace std::string_literals;
+    container.Add(svg::Circle()
+            .SetCenter(point)
+            .SetRadius(style.stop_radius)
+            .SetFillColor("white"s));
+}
+
+void MapRenderer::AddStopLabel(svg::ObjectContainer& container, const RenderStyle& style,
+                               const Stop* stop, svg::Point point) const {
+    container.Add(GetUnderlayerTextStop(style, stop, point));
+    container.Add(GetTextStop(style, stop, point));
+}
 
-        map_.Add(CreateBusLine(bus.second, projector)
-                .SetStrokeLineJoin(svg::StrokeLineJoin::ROUND)
-                .SetStrokeLineCap(svg::StrokeLineCap::ROUND)
-                .SetFillColor("none"s)
-                .SetStrokeColor(color_palette_[color_count++])
-                .SetStrokeWidth(line_width_));
+namespace {
 
-        if(color_count == color_palette_.size()) {
-            color_count = 0;
+// Меньшие части не выносятся в отдельные потоки
+const size_t MIN_CHUNK_SIZE = 64;
+
+// Делит items на части и строит их в отдельных потоках, каждая часть в своём svg::Document.
+// render_item(document, item, flush) добавляет в document элементы фрагмента и вызывает
+// flush(target), который выводит их в строку target и очищает document.
+// Если часть всего одна, она строится в текущем потоке
+template <typename Item, typename RenderItem>
+void RenderFragments(const std::vector<Item>& items, size_t thread_count, RenderItem render_item) {
+    auto render_range = [&items, render_item](size_t begin, size_t end) {
+        svg::Document document;
+        auto flush = [&document](std::string& target) {
+            target.clear();
+            json::StringStreambuf buf(target);
+            std::ostream out(&buf);
+            document.RenderBody(out);
+            document.Clear();
+        };
+        for(size_t i = begin; i < end; ++i) {
+            render_item(document, items[i], flush);
         }
+    };
+
+    size_t chunk_size = std::max(MIN_CHUNK_SIZE, (items.size() + thread_count - 1) / thread_count);
+    if(items.size() <= chunk_size) {
+        render_range(0, items.size());
+        return;
+    }
+
+    std::vector<std::future<void>> tasks;
+    for(size_t begin = 0; begin < items.size(); begin += chunk_size) {
+        tasks.push_back(std::async(std::launch::async, render_range,
+                                   begin, std::min(items.size(), begin + chunk_size)));
+    }
+    for(auto& task : tasks) {
+        task.get();
     }
 }
 
-void MapRenderer::SetBusesLabel(const std::map<std::string_view, Bus*> buses,
-                                const SphereProjector& projector) {
-    size_t color_count = 0;
-    for(const auto& bus : buses) {
-        if(bus.second->stops_.empty()) {
-            continue;
+}
+
+void MapRenderer::SetMap(const transport_list::TransportCatalogue& catalog) {
+    catalog_ = &catalog;
+    if(!streaming_) {
+        BuildMap();
+    }
+}
+
+void MapRenderer::SetThreadCount(size_t count) {
+    thread_count_ = count;
+}
+
+void MapRenderer::BuildPlan() {
+    std::optional<SphereProjector> previous_projector;
+    size_t projection_version = 0;
+    if(plan_) {
+        previous_projector = plan_->projector;
+        projection_version = plan_->projection_version;
+    }
+
+    plan_.emplace();
+    plan_->catalog_version = catalog_ ? catalog_->GetVersion() : 0;
+    plan_->layout_version = layout_version_;
+    plan_->projection_version = projection_version + 1;
+
+    if(!catalog_) {
+        return;
+    }
+    const TransportCatalogue& catalog = *catalog_;
+    RenderPlan& plan = *plan_;
+
+    std::vector<const Bus*> sorted_buses;
+    sorted_buses.reserve(catalog.GetAllBuses().size());
+    for(const auto& [name, bus] : catalog.GetAllBuses()) {
+        if(!bus->stops_.empty()) {
+            sorted_buses.push_back(bus);
         }
+    }
+    std::sort(sorted_buses.begin(), sorted_buses.end(), [](const Bus* lhs, const Bus* rhs) {
+        return lhs->title_ < rhs->title_;
+    });
 
-        auto stop_start = *(bus.second->stops_.begin());
-        map_.Add(GetUnderlayerTextBus(bus.second, stop_start, projector));
-        map_.Add(GetTextBus(bus.second, stop_start, color_count, projector));
+    // Цвета назначаются заранее, чтобы части слоёв строились независимо
+    for(const Bus* bus : sorted_buses) {
+        plan.buses.push_back({bus, style_.color_palette.empty() ? 0 : plan.buses.size() % style_.color_palette.size()});
+    }
 
-        if(!bus.second->is_round_
-                && (stop_start->title_ != bus.second->last_stop_->title_)) {
-            map_.Add(GetUnderlayerTextBus(bus.second, bus.second->last_stop_, projector));
-            map_.Add(GetTextBus(bus.second, bus.second->last_stop_, color_count, projector));
+    std::vector<bool> on_route(catalog.GetAllStops().size(), false);
+    for(const Bus* bus : sorted_buses) {
+        for(const Stop* stop : bus->stops_) {
+            if(!on_route[stop->id_]) {
+                on_route[stop->id_] = true;
+                plan.stops.push_back(stop);
+            }
         }
+    }
+    std::sort(plan.stops.begin(), plan.stops.end(), [](const Stop* lhs, const Stop* rhs) {
+        return lhs->GetTitle() < rhs->GetTitle();
+    });
 
-        ++color_count;
-        if(color_count >= color_palette_.size()) {
-            color_count = 0;
+    // Каждая остановка проецируется один раз, независимо от числа маршрутов через неё.
+    // Целые координаты переводятся в double только при проецировании
+    auto project = [&](const auto& all_coords) {
+        auto stops_coords = GatherCoordinates(all_coords, plan.stops);
+        return plan.projector.emplace(stops_coords, width_, height_, padding_).Project(stops_coords);
+    };
+    std::vector<svg::Point> projected = catalog.HasCompactCoordinates()
+            ? project(catalog.GetFixedStopCoordinates())
+            : project(catalog.GetStopCoordinates());
+    const SphereProjector& projector = *plan.projector;
+    if(previous_projector && *previous_projector == projector) {
+        plan.projection_version = projection_version;
+    }
+
+    plan.stop_points.resize(catalog.GetAllStops().size());
+    for(size_t i = 0; i < plan.stops.size(); ++i) {
+        plan.stop_points[plan.stops[i]->id_] = projected[i];
+    }
+
+    plan.bus_labels.reserve(plan.buses.size());
+    for(const auto& [bus, color] : plan.buses) {
+        const Stop* stop_start = bus->stops_.front();
+        BusLabelAnchors& anchors = plan.bus_labels.emplace_back();
+        anchors.start = plan.stop_points[stop_start->id_];
+        if(!bus->is_round_ && stop_start->GetTitle() != bus->last_stop_->GetTitle()) {
+            anchors.last = plan.stop_points[bus->last_stop_->id_];
         }
     }
 }
 
-void MapRenderer::SetBusesStops(const std::set<Stop*> stops,
-                                const SphereProjector& projector) {
-    using namespace std::string_literals;
+MapRenderer::RenderPlan& MapRenderer::GetPlan() {
+    size_t catalog_version = catalog_ ? catalog_->GetVersion() : 0;
+    if(!plan_
+            || plan_->catalog_version != catalog_version
+            || plan_->layout_version != layout_version_) {
+        BuildPlan();
+    }
+    return *plan_;
+}
+
+void MapRenderer::BuildMap() {
+    const RenderPlan& plan = GetPlan();
+
+    // Классы стилей нумеруются в порядке вывода, а положение подписи зависит
+    // от всех предыдущих, поэтому такие карты строятся целиком за один проход, без фрагментов
+    if(compact_output_ || avoid_label_collisions_) {
+        cache_.emplace();
+        cache_->catalog_version = plan.catalog_version;
+        cache_->settings_version = settings_version_;
+        json::StringStreambuf buf(cache_->svg);
+        std::ostream out(&buf);
+        StreamMap(out);
+        return;
+    }
 
-    for(const auto& stop : stops) {
-        map_.Add(svg::Circle()
-                .SetCenter(projector(stop->coords_))
-                .SetRadius(stop_radius_)
-                .SetFillColor("white"s));
+    UpdateFragments(plan);
+
+    cache_.emplace();
+    cache_->catalog_version = plan.catalog_version;
+    cache_->settings_version = settings_version_;
+
+    json::StringStreambuf buf(cache_->svg);
+    std::ostream out(&buf);
+    svg::Document::RenderBegin(out);
+    for(const auto& [bus, color] : plan.buses) {
+        out << fragments_.buses.at(bus).shape;
+    }
+    for(const auto& [bus, color] : plan.buses) {
+        out << fragments_.buses.at(bus).label;
+    }
+    for(const Stop* stop : plan.stops) {
+        out << fragments_.stops[stop->id_].shape;
+    }
+    for(const Stop* stop : plan.stops) {
+        out << fragments_.stops[stop->id_].label;
     }
+    svg::Document::RenderEnd(out);
 }
 
-void MapRenderer::SetBusesStopsLabel(const std::set<Stop*> stops,
-                                     const SphereProjector& projector) {
+void MapRenderer::UpdateFragments(const RenderPlan& plan) {
+    if(fragments_.catalog != catalog_
+            || fragments_.settings_version != settings_version_
+            || fragments_.projection_version != plan.projection_version) {
+        fragments_ = FragmentCache{catalog_, settings_version_, plan.projection_version, {}, {}};
+    }
+    fragments_.stops.resize(plan.stop_points.size());
+
+    // Элементы контейнеров не перемещаются, поэтому потоки пишут в свои фрагменты без блокировок
+    std::vector<std::pair<const BusColor*, Fragments*>> stale_buses;
+    for(size_t id = 0; id < plan.buses.size(); ++id) {
+        Fragments& fragments = fragments_.buses[plan.buses[id].first];
+        if(!fragments.is_valid || fragments.color != plan.buses[id].second) {
+            stale_buses.push_back({&plan.buses[id], &fragments});
+            fragments.color = plan.buses[id].second;
+        }
+    }
+
+    std::vector<const Stop*> stale_stops;
+    for(const Stop* stop : plan.stops) {
+        if(!fragments_.stops[stop->id_].is_valid) {
+            stale_stops.push_back(stop);
+        }
+    }
 
-    for(const auto& stop : stops) {
-        map_.Add(GetUnderlayerTextStop(stop, projector));
-        map_.Add(GetTextStop(stop, projector));
+    size_t thread_count = thread_count_;
+    if(thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
     }
+
+    RenderFragments(stale_buses, thread_count, [this, &plan](auto& container, const auto& item, auto flush) {
+        const auto& [bus, fragments] = item;
+        AddBusLine(container, style_, *bus, plan.stop_points);
+        flush(fragments->shape);
+        AddBusLabel(container, style_, *bus, plan.bus_labels[bus - plan.buses.data()]);
+        flush(fragments->label);
+        fragments->hash = domain::detail::ContentHasher()
+                .AddString(fragments->shape)
+                .AddString(fragments->label)
+                .Get();
+        fragments->is_valid = true;
+    });
+    RenderFragments(stale_stops, thread_count, [this, &plan](auto& container, const Stop* stop, auto flush) {
+        Fragments& fragments = fragments_.stops[stop->id_];
+        AddStopCircle(container, style_, plan.stop_points[stop->id_]);
+        flush(fragments.shape);
+        AddStopLabel(container, style_, stop, plan.stop_points[stop->id_]);
+        flush(fragments.label);
+        fragments.hash = domain::detail::ContentHasher()
+                .AddString(fragments.shape)
+                .AddString(fragments.label)
+                .Get();
+        fragments.is_valid = true;
+    });
+
+    SaveSnapshot(plan);
 }
 
-void MapRenderer::SetMap(const transport_list::TransportCatalogue& catalog) {
-    using namespace std::string_literals;
+namespace {
 
-    std::map<std::string_view, Bus*> buses;
+std::string GetElementKey(const Bus* bus) {
+    return "bus:" + bus->title_;
+}
 
-    std::for_each(catalog.GetAllBuses().begin(),
-              catalog.GetAllBuses().end(),
-              [&] (const auto& item) {
-                    buses.insert(item);
-                }
-                );
+std::string GetElementKey(const Stop* stop) {
+    return std::string("stop:").append(stop->GetTitle());
+}
+
+}
+
+void MapRenderer::SaveSnapshot(const RenderPlan& plan) {
+    std::string etag = GetETag({});
+    if(!history_.empty() && history_.back().etag == etag) {
+        return;
+    }
+
+    MapSnapshot& snapshot = history_.emplace_back();
+    snapshot.etag = std::move(etag);
+    for(const auto& [bus, color] : plan.buses) {
+        snapshot.elements.emplace(GetElementKey(bus), fragments_.buses.at(bus).hash);
+    }
+    for(const Stop* stop : plan.stops) {
+        snapshot.elements.emplace(GetElementKey(stop), fragments_.stops[stop->id_].hash);
+    }
+
+    if(history_.size() > MAP_HISTORY_SIZE) {
+        history_.pop_front();
+    }
+}
+
+std::optional<MapDelta> MapRenderer::GetMapDelta(const std::string& base_etag) {
+    if(compact_output_ || avoid_label_collisions_) {
+        return std::nullopt;
+    }
+
+    // Хватает фрагментов: документ целиком не собирается, в том числе в потоковом режиме
+    const RenderPlan& plan = GetPlan();
+    UpdateFragments(plan);
+    auto base = std::find_if(history_.begin(), history_.end(), [&base_etag](const MapSnapshot& snapshot) {
+        return snapshot.etag == base_etag;
+    });
+    if(base == history_.end()) {
+        return std::nullopt;
+    }
+
+    MapDelta delta;
+    delta.etag = history_.back().etag;
+
+    auto compare = [&delta, &base](std::string key, const Fragments& fragments, size_t position) {
+        auto it = base->elements.find(key);
+        if(it == base->elements.end()) {
+            delta.added.push_back({std::move(key), fragments.shape, fragments.label, position});
+        } else if(it->second != fragments.hash) {
+            delta.changed.push_back({std::move(key), fragments.shape, fragments.label, position});
+        }
+    };
+    for(size_t id = 0; id < plan.buses.size(); ++id) {
+        const Bus* bus = plan.buses[id].first;
+        compare(GetElementKey(bus), fragments_.buses.at(bus), id);
+    }
+    for(size_t id = 0; id < plan.stops.size(); ++id) {
+        const Stop* stop = plan.stops[id];
+        compare(GetElementKey(stop), fragments_.stops[stop->id_], id);
+    }
+
+    const auto& current = history_.back().elements;
+    for(const auto& [key, hash] : base->elements) {
+        if(current.count(key) == 0) {
+            delta.removed.push_back(key);
+        }
+    }
+
+    return delta;
+}
+
+bool MapRenderer::IsActual(const std::optional<MapCache>& cache) const {
+    size_t catalog_version = catalog_ ? catalog_->GetVersion() : 0;
+    return cache
+            && cache->catalog_version == catalog_version
+            && cache->settings_version == settings_version_;
+}
+
+MapRenderer::MapCache& MapRenderer::GetCache() {
+    if(!IsActual(cache_)) {
+        BuildMap();
+    }
+    return *cache_;
+}
+
+void MapRenderer::BuildThemes() {
+    const RenderPlan& plan = GetPlan();
+
+    // План строится до запуска потоков, дальше темы только читают его
+    std::vector<std::future<void>> tasks;
+    for(auto& [name, theme] : themes_) {
+        if(IsActual(theme.cache)) {
+            continue;
+        }
+        MapCache& cache = theme.cache.emplace();
+        cache.catalog_version = plan.catalog_version;
+        cache.settings_version = settings_version_;
+        tasks.push_back(std::async(std::launch::async, [this, &plan, &style = theme.style, &cache] {
+            json::StringStreambuf buf(cache.svg);
+            std::ostream out(&buf);
+            WriteMap(out, plan, style);
+        }));
+    }
+    for(auto& task : tasks) {
+        task.get();
+    }
+}
+
+MapRenderer::Theme& MapRenderer::GetTheme(const std::string& name) {
+    Theme& theme = themes_.at(name);
+    if(!IsActual(theme.cache)) {
+        BuildThemes();
+    }
+    return theme;
+}
+
+const std::string& MapRenderer::GetThemeSvg(const std::string& name) {
+    return GetTheme(name).cache->svg;
+}
+
+const std::string& MapRenderer::GetThemeMap(const std::string& name) {
+    MapCache& cache = *GetTheme(name).cache;
+    if(cache.escaped.empty()) {
+        json::StringStreambuf buf(cache.escaped);
+        json::EscapingStreambuf escaping_buf(&buf);
+        escaping_buf.sputn(cache.svg.data(), cache.svg.size());
+    }
+    return cache.escaped;
+}
+
+const MapRenderer::TileIndex& MapRenderer::GetTileIndex(RenderPlan& plan) const {
+    if(plan.tile_index) {
+        return *plan.tile_index;
+    }
+
+    spatial::Rect bounds{0, 0, width_, height_};
+    const StopPoints& points = plan.stop_points;
+
+    size_t segment_count = 0;
+    for(const auto& bus : plan.buses) {
+        segment_count += bus.first->stops_.size();
+    }
+
+    TileIndex& index = plan.tile_index.emplace(TileIndex{{bounds, segment_count},
+                                                         {bounds, plan.stops.size()}});
+
+    for(size_t id = 0; id < plan.buses.size(); ++id) {
+        const auto& stops = plan.buses[id].first->stops_;
+        svg::Point start = points[stops.front()->id_];
+        index.buses.Insert(id, spatial::Rect::FromPoints(start, start));
+        for(size_t i = 1; i < stops.size(); ++i) {
+            svg::Point end = points[stops[i]->id_];
+            index.buses.Insert(id, spatial::Rect::FromPoints(start, end));
+            start = end;
+        }
+    }
+
+    for(size_t id = 0; id < plan.stops.size(); ++id) {
+        svg::Point point = points[plan.stops[id]->id_];
+        index.stops.Insert(id, spatial::Rect::FromPoints(point, point));
+    }
 
-    std::vector<geo::Coordinates> stops_coords;
-    std::set<Stop*> stops;
+    return index;
+}
+
+const MapRenderer::LodLevel& MapRenderer::GetLodLevel(RenderPlan& plan, int zoom) const {
+    if(auto it = plan.lod_levels.find(zoom); it != plan.lod_levels.end()) {
+        return it->second;
+    }
+
+    // Допуск задан в пикселях тайла, в координатах полной карты он в 2^zoom раз меньше
+    double tolerance = std::ldexp(lod_tolerance_, -zoom);
+    const StopPoints& points = plan.stop_points;
+    LodLevel& level = plan.lod_levels[zoom];
+
+    level.bus_lines.reserve(plan.buses.size());
+    for(const auto& bus : plan.buses) {
+        std::vector<svg::Point> line;
+        line.reserve(bus.first->stops_.size());
+        for(const auto& stop : bus.first->stops_) {
+            line.push_back(points[stop->id_]);
+        }
+        level.bus_lines.push_back(spatial::Simplify(line, tolerance));
+    }
 
-    for(const auto& bus : catalog.GetAllBuses()) {
-        for(const auto& stop : bus.second->stops_) {
-            stops.insert(stop);
-            stops_coords.push_back(stop->coords_);
+    // Из остановок, попавших в одну клетку размером с допуск, выводится только первая
+    level.visible_stops.assign(plan.stops.size(), true);
+    if(tolerance > 0) {
+        std::set<std::pair<long long, long long>> occupied;
+        for(size_t id = 0; id < plan.stops.size(); ++id) {
+            svg::Point point = points[plan.stops[id]->id_];
+            level.visible_stops[id] = occupied.emplace(std::llround(point.x / tolerance),
+                                                       std::llround(point.y / tolerance)).second;
         }
     }
 
-    SphereProjector projector(stops_coords.begin(), stops_coords.end(), width_, height_, padding_);
+    return level;
+}
+
+Viewport MapRenderer::GetTileViewport(int z, int x, int y) const {
+    double scale = std::ldexp(1.0, std::clamp(z, 0, 30));
+    double tile_width = width_ / scale;
+    double tile_height = height_ / scale;
+    return {{x * tile_width, y * tile_height, (x + 1) * tile_width, (y + 1) * tile_height}, scale};
+}
+
+Viewport MapRenderer::GetBoundsViewport(const geo::Coordinates& query_min, const geo::Coordinates& query_max) {
+    const RenderPlan& plan = GetPlan();
+    if(!plan.projector) {
+        return {{0, 0, width_, height_}, 1};
+    }
+
+    // Границы округляются так же, как координаты остановок, чтобы остановка
+    // с координатами на границе не оказалась снаружи
+    geo::Coordinates min = query_min;
+    geo::Coordinates max = query_max;
+    if(catalog_->HasCompactCoordinates()) {
+        min = geo::Quantize(query_min);
+        max = geo::Quantize(query_max);
+    }
+
+    const SphereProjector& projector = *plan.projector;
+    spatial::Rect area = spatial::Rect::FromPoints(projector({max.lat, min.lng}),
+                                                   projector({min.lat, max.lng}));
+    double area_width = area.max_x - area.min_x;
+    double area_height = area.max_y - area.min_y;
+
+    double scale = 1;
+    if(!IsZero(area_width) && !IsZero(area_height)) {
+        scale = std::min(width_ / area_width, height_ / area_height);
+    } else if(!IsZero(area_width)) {
+        scale = width_ / area_width;
+    } else if(!IsZero(area_height)) {
+        scale = height_ / area_height;
+    }
+    return {area, scale};
+}
+
+std::string MapRenderer::GetTileSvg(const Viewport& viewport) {
+    RenderPlan& plan = GetPlan();
+
+    std::string result;
+    json::StringStreambuf buf(result);
+    std::ostream out(&buf);
+    svg::Document::RenderBegin(out);
 
-    SetBuses(buses, projector);
+    if(plan.projector) {
+        const TileIndex& index = GetTileIndex(plan);
+        const spatial::Rect& area = viewport.area;
+        auto to_tile = [&area, scale = viewport.scale](svg::Point point) {
+            return svg::Point{(point.x - area.min_x) * scale, (point.y - area.min_y) * scale};
+        };
 
-    SetBusesLabel(buses, projector);
+        // Границы области в координатах тайла. Элементы у самой границы сохраняются
+        // с запасом на толщину линий и радиус остановок, чтобы соседние тайлы стыковались
+        spatial::Rect tile{0, 0, (area.max_x - area.min_x) * viewport.scale,
+                           (area.max_y - area.min_y) * viewport.scale};
+        spatial::Rect line_clip = tile.Expanded(style_.line_width);
+        spatial::Rect stop_clip = tile.Expanded(style_.stop_radius);
 
-    SetBusesStops(stops, projector);
+        // Подпись маршрута выводится у конечной остановки, поэтому маршруты ищутся с тем же запасом
+        double bus_margin = std::max(style_.line_width + lod_tolerance_, style_.stop_radius);
+        std::vector<size_t> bus_ids = index.buses.Query(area.Expanded(bus_margin / viewport.scale));
+        std::vector<size_t> stop_ids = index.stops.Query(area.Expanded(style_.stop_radius / viewport.scale));
 
-    SetBusesStopsLabel(stops, projector);
+        int zoom = std::clamp(static_cast<int>(std::floor(std::log2(viewport.scale) + EPSILON)), 0, 30);
+        const LodLevel& level = GetLodLevel(plan, zoom);
 
-   // map_.Render(std::cout);
+        svg::Document document;
+        std::vector<svg::Point> line;
+        for(size_t id : bus_ids) {
+            line.clear();
+            for(const auto& point : level.bus_lines[id]) {
+                line.push_back(to_tile(point));
+            }
+            AddClippedBusLine(document, style_, line, plan.buses[id].second, line_clip);
+        }
+        for(size_t id : bus_ids) {
+            const BusLabelAnchors& anchors = plan.bus_labels[id];
+            svg::Point start = to_tile(anchors.start);
+            if(stop_clip.Contains(start)) {
+                AddBusLabelAt(document, style_, plan.buses[id], start);
+            }
+            if(anchors.last) {
+                svg::Point last = to_tile(*anchors.last);
+                if(stop_clip.Contains(last)) {
+                    AddBusLabelAt(document, style_, plan.buses[id], last);
+                }
+            }
+        }
+
+        // Точная проверка: в ячейках сетки могут оказаться остановки за пределами области.
+        // Остановки, слившиеся на этом масштабе с другими, не выводятся вместе с подписями
+        std::vector<std::pair<const Stop*, svg::Point>> stops;
+        for(size_t id : stop_ids) {
+            svg::Point point = to_tile(plan.stop_points[plan.stops[id]->id_]);
+            if(level.visible_stops[id] && stop_clip.Contains(point)) {
+                stops.push_back({plan.stops[id], point});
+            }
+        }
+        for(const auto& [stop, point] : stops) {
+            AddStopCircle(document, style_, point);
+        }
+        for(const auto& [stop, point] : stops) {
+            AddStopLabel(document, style_, stop, point);
+        }
+
+        if(compact_output_) {
+            document.RenderCompactBody(out, *compact_output_);
+            document.RenderStyleSheet(out);
+        } else {
+            document.RenderBody(out);
+        }
+    }
 
+    svg::Document::RenderEnd(out);
+    return result;
 }
 
 void MapRenderer::RenderMap() const {
-    map_.Render(std::cout);
-}
-
-std::string MapRenderer::GetMap() const {
-    std::ostringstream strm;
-    map_.Render(strm);
-    std::string str;
-
-    for(char c : strm.str()) {
-        if(c == '"') {
-           str += '\\';
-           str += c;
-        } else if(c == '\n') {
-           str += '\\';
-           str += 'n';
-        }  else {
-           str += c;
+    if(cache_) {
+        std::cout << cache_->svg;
+    }
+}
+
+const std::string& MapRenderer::GetSvg() {
+    return GetCache().svg;
+}
+
+const std::string& MapRenderer::GetMap() {
+    MapCache& cache = GetCache();
+    if(cache.escaped.empty()) {
+        json::StringStreambuf buf(cache.escaped);
+        json::EscapingStreambuf escaping_buf(&buf);
+        escaping_buf.sputn(cache.svg.data(), cache.svg.size());
+    }
+    return cache.escaped;
+}
+
+void MapRenderer::PrintMap(std::ostream& out) {
+    if(streaming_) {
+        json::EscapingStreambuf escaping_buf(out.rdbuf());
+        std::ostream escaped(&escaping_buf);
+        StreamMap(escaped);
+        escaping_buf.pubsync();
+        return;
+    }
+
+    const std::string& map = GetMap();
+    out.write(map.data(), map.size());
+}
+
+void MapRenderer::PrintSvg(std::ostream& out) {
+    if(streaming_) {
+        StreamMap(out);
+        return;
+    }
+
+    const std::string& svg = GetSvg();
+    out.write(svg.data(), svg.size());
+}
+
+void MapRenderer::SetStreaming(bool streaming) {
+    streaming_ = streaming;
+}
+
+namespace {
+
+// Приблизительные размеры текста: символ шириной 0.6 кегля,
+// над базовой линией 0.8 кегля, под ней 0.2
+const double CHAR_WIDTH = 0.6;
+const double ASCENT = 0.8;
+const double DESCENT = 0.2;
+
+double GetTextWidth(std::string_view text, int font_size) {
+    // Символы UTF-8 считаются по первым байтам
+    size_t char_count = std::count_if(text.begin(), text.end(), [](char c) {
+        return (static_cast<unsigned char>(c) & 0xC0) != 0x80;
+    });
+    return char_count * CHAR_WIDTH * font_size;
+}
+
+// Обводка подложки расширяет текст на половину своей толщины
+spatial::Rect GetTextBounds(svg::Point position, double width, int font_size, double stroke_width) {
+    return spatial::Rect{position.x, position.y - ASCENT * font_size,
+                         position.x + width, position.y + DESCENT * font_size}.Expanded(stroke_width / 2);
+}
+
+}
+
+MapRenderer::LabelLayout MapRenderer::PlaceLabels(const RenderPlan& plan,
+                                                  const RenderStyle& style) const {
+    LabelLayout layout;
+    layout.bus_labels.resize(2 * plan.buses.size());
+    layout.stop_labels.resize(plan.stops.size());
+
+    const spatial::Rect canvas{0, 0, width_, height_};
+    spatial::PlacementGrid grid(canvas, layout.bus_labels.size() + layout.stop_labels.size());
+
+    // Кроме заданного смещения пробуются его отражения по горизонтали и вертикали.
+    // Возвращается точка, от которой подпись с исходным смещением окажется на свободном месте.
+    // Положения, при которых подпись выходит за холст, не подходят: такая подпись скрывается
+    auto place = [&grid, &canvas, &style](std::string_view text, svg::Point point,
+                                 const std::vector<double>& offset, int font_size) -> std::optional<svg::Point> {
+        double width = GetTextWidth(text, font_size);
+        double dx = offset[0];
+        double dy = offset[1];
+        double mirror_x = -dx - width;
+        double mirror_y = -dy + (ASCENT - DESCENT) * font_size;
+
+        for(svg::Point candidate : {svg::Point{dx, dy}, svg::Point{mirror_x, dy},
+                                    svg::Point{dx, mirror_y}, svg::Point{mirror_x, mirror_y}}) {
+            svg::Point position{point.x + candidate.x, point.y + candidate.y};
+            spatial::Rect bounds = GetTextBounds(position, width, font_size, style.underlayer_width);
+            if(canvas.Contains(bounds) && grid.TryPlace(bounds)) {
+                return svg::Point{point.x + candidate.x - dx, point.y + candidate.y - dy};
+            }
+        }
+        return std::nullopt;
+    };
+
+    for(size_t id = 0; id < plan.buses.size(); ++id) {
+        const Bus* bus = plan.buses[id].first;
+        const BusLabelAnchors& anchors = plan.bus_labels[id];
+        layout.bus_labels[2 * id] = place(bus->title_, anchors.start,
+                                          style.bus_label_offset, style.bus_label_font_size);
+        if(anchors.last) {
+            layout.bus_labels[2 * id + 1] = place(bus->title_, *anchors.last,
+                                                  style.bus_label_offset, style.bus_label_font_size);
+        }
+    }
+
+    for(size_t id = 0; id < plan.stops.size(); ++id) {
+        const Stop* stop = plan.stops[id];
+        layout.stop_labels[id] = place(stop->GetTitle(), plan.stop_points[stop->id_],
+                                       style.stop_label_offset, style.stop_label_font_size);
+    }
+
+    return layout;
+}
+
+void MapRenderer::StreamMap(std::ostream& out) {
+    WriteMap(out, GetPlan(), style_);
+}
+
+void MapRenderer::WriteMap(std::ostream& out, const RenderPlan& plan,
+                           const RenderStyle& style) const {
+    // Контейнер очищается после каждого элемента, таблица стилей в нём сохраняется
+    svg::Document element;
+    auto flush = [this, &element, &out] {
+        if(compact_output_) {
+            element.RenderCompactBody(out, *compact_output_);
+        } else {
+            element.RenderBody(out);
         }
+        element.Clear();
+    };
+
+    // Цвета назначаются по палитре темы, длина которой может отличаться от основной
+    auto bus_color = [&plan, &style](size_t id) {
+        size_t palette_size = style.color_palette.size();
+        return BusColor{plan.buses[id].first, palette_size == 0 ? 0 : id % palette_size};
+    };
+
+    std::optional<LabelLayout> labels;
+    if(avoid_label_collisions_) {
+        labels = PlaceLabels(plan, style);
     }
 
-    return str;
+    svg::Document::RenderBegin(out);
+    for(size_t id = 0; id < plan.buses.size(); ++id) {
+        AddBusLine(element, style, bus_color(id), plan.stop_points);
+        flush();
+    }
+    for(size_t id = 0; id < plan.buses.size(); ++id) {
+        if(!labels) {
+            AddBusLabel(element, style, bus_color(id), plan.bus_labels[id]);
+        } else {
+            for(size_t i = 2 * id; i < 2 * id + 2; ++i) {
+                if(labels->bus_labels[i]) {
+                    AddBusLabelAt(element, style, bus_color(id), *labels->bus_labels[i]);
+                }
+            }
+        }
+        flush();
+    }
+    for(const Stop* stop : plan.stops) {
+        AddStopCircle(element, style, plan.stop_points[stop->id_]);
+        flush();
+    }
+    for(size_t id = 0; id < plan.stops.size(); ++id) {
+        const Stop* stop = plan.stops[id];
+        if(!labels) {
+            AddStopLabel(element, style, stop, plan.stop_points[stop->id_]);
+        } else if(labels->stop_labels[id]) {
+            AddStopLabel(element, style, stop, *labels->stop_labels[id]);
+        }
+        flush();
+    }
+    if(compact_output_) {
+        element.RenderStyleSheet(out);
+    }
+    svg::Document::RenderEnd(out);
 }
 
 }
@@ -1,12 +1,16 @@
 #pragma once
 
 #include <variant>
+#include <deque>
 #include <map>
 #include <algorithm>
+#include <optional>
+#include <unordered_map>
 
 #include "transport_catalogue.h"
 #include "svg.h"
 #include "domain.h"
+#include "spatial_index.h"
 
 /*
  * В этом файле вы можете разместить код, отвечающий за визуализацию карты маршрутов в формате SVG.
@@ -16,6 +20,8 @@
 namespace renderer {
 
 inline const double EPSILON = 1e-6;
+// Число версий карты, относительно которых можно получить изменения
+inline const size_t MAP_HISTORY_SIZE = 16;
 inline bool IsZero(double value) {
     return std::abs(value) < EPSILON;
 }
@@ -25,59 +31,123 @@ public:
     template <typename PointInputIt>
     SphereProjector(PointInputIt points_begin, PointInputIt points_end, double max_width,
                     double max_height, double padding)
-        : padding_(padding) {
+        : offset_x_(padding)
+        , offset_y_(padding) {
         if (points_begin == points_end) {
             return;
         }
 
-        const auto [left_it, right_it]
-            = std::minmax_element(points_begin, points_end, [](auto lhs, auto rhs) {
-                  return lhs.lng < rhs.lng;
-              });
-        min_lon_ = left_it->lng;
-        const double max_lon = right_it->lng;
-
-        const auto [bottom_it, top_it]
-            = std::minmax_element(points_begin, points_end, [](auto lhs, auto rhs) {
-                  return lhs.lat < rhs.lat;
-              });
-        const double min_lat = bottom_it->lat;
-        max_lat_ = top_it->lat;
-
-        std::optional<double> width_zoom;
-        if (!IsZero(max_lon - min_lon_)) {
-            width_zoom = (max_width - 2 * padding) / (max_lon - min_lon_);
+        // Границы находятся за один проход
+        double min_lon = points_begin->lng;
+        double max_lon = min_lon;
+        double min_lat = points_begin->lat;
+        double max_lat = min_lat;
+        for (auto it = points_begin; it != points_end; ++it) {
+            min_lon = std::min(min_lon, it->lng);
+            max_lon = std::max(max_lon, it->lng);
+            min_lat = std::min(min_lat, it->lat);
+            max_lat = std::max(max_lat, it->lat);
         }
+        SetBounds(min_lon, max_lon, min_lat, max_lat, max_width, max_height, padding);
+    }
 
-        std::optional<double> height_zoom;
-        if (!IsZero(max_lat_ - min_lat)) {
-            height_zoom = (max_height - 2 * padding) / (max_lat_ - min_lat);
-        }
+    // Границы считаются векторными инструкциями по массивам широт и долгот
+    SphereProjector(const geo::CoordinatesArray& points, double max_width,
+                    double max_height, double padding);
+    // По целым координатам за шаг обрабатываются четыре значения, в double
+    // переводятся только найденные границы
+    SphereProjector(const geo::FixedCoordinatesArray& points, double max_width,
+                    double max_height, double padding);
 
-        if (width_zoom && height_zoom) {
-            zoom_coeff_ = std::min(*width_zoom, *height_zoom);
-        } else if (width_zoom) {
-            zoom_coeff_ = *width_zoom;
-        } else if (height_zoom) {
-            zoom_coeff_ = *height_zoom;
-        }
+    svg::Point operator()(geo::Coordinates coords) const {
+        return {(coords.lng - min_lon_) * zoom_coeff_ + offset_x_,
+                (max_lat_ - coords.lat) * zoom_coeff_ + offset_y_};
     }
 
-    svg::Point operator()(geo::Coordinates coords) const {
-        return {(coords.lng - min_lon_) * zoom_coeff_ + padding_,
-                (max_lat_ - coords.lat) * zoom_coeff_ + padding_};
+    bool operator==(const SphereProjector& other) const {
+        return offset_x_ == other.offset_x_ && offset_y_ == other.offset_y_
+                && min_lon_ == other.min_lon_ && max_lat_ == other.max_lat_
+                && zoom_coeff_ == other.zoom_coeff_;
     }
 
+    // Проецирует все точки массива, результат совпадает с поточечным вызовом operator()
+    std::vector<svg::Point> Project(const geo::CoordinatesArray& points) const;
+    // То же для целых координат, результат совпадает с поточечным вызовом operator()
+    // для координат, переведённых в double через geo::FromFixed
+    std::vector<svg::Point> Project(const geo::FixedCoordinatesArray& points) const;
+
 private:
-    double padding_;
+    double offset_x_;
+    double offset_y_;
     double min_lon_ = 0;
     double max_lat_ = 0;
     double zoom_coeff_ = 0;
+
+    void SetBounds(double min_lon, double max_lon, double min_lat, double max_lat,
+                   double max_width, double max_height, double padding);
 };
 
 
 using ColorArray = std::vector<svg::Color>;
 
+// Оформление карты - настройки, не влияющие на геометрию. Темы из render_settings
+// задают только оформление и строятся по общему плану отрисовки
+struct RenderStyle {
+    double stop_radius = 1;
+    double line_width = 1;
+    double underlayer_width = 0;
+
+    int bus_label_font_size = 1;
+    int stop_label_font_size = 1;
+
+    std::vector<double> bus_label_offset{0, 0};
+    std::vector<double> stop_label_offset{0, 0};
+
+    svg::Color underlayer_color;
+    ColorArray color_palette;
+
+    void SetLineWidth(double line_width);
+    void StopRadius(double stop_radius);
+    void SetUnderlayerWidth(double width);
+
+    void SetBusFontSize(int font_size);
+    void SetStopFontSize(int font_size);
+
+    // Смещение задаётся парой чисел, иначе остаётся прежним
+    void SetBusLabelOffset(const std::vector<double>& params);
+    void SetStopLabelOffset(const std::vector<double>& params);
+
+    void SetUnderLayerColor(const svg::Color& color);
+    void SetColorPalette(const ColorArray& color_arr);
+};
+
+// Область полной карты и масштаб, с которым она выводится
+struct Viewport {
+    spatial::Rect area;
+    double scale = 1;
+};
+
+// Svg-фрагменты элемента карты. Элементы различаются ключами "bus:название" и "stop:название"
+struct ElementDelta {
+    std::string key;
+    std::string shape;
+    std::string label;
+    // Номер элемента среди маршрутов или среди остановок текущей версии карты
+    size_t position = 0;
+};
+
+// Изменения карты относительно более ранней версии. Карта состоит из четырёх слоёв
+// подряд: линии маршрутов, подписи маршрутов, круги остановок, подписи остановок.
+// В каждом слое элементы идут по возрастанию названий, поэтому shape маршрута с номером
+// position - position-й элемент первого слоя, а его label - второго; у остановок - третий
+// и четвёртый слои
+struct MapDelta {
+    std::string etag;
+    std::vector<ElementDelta> added;
+    std::vector<ElementDelta> changed;
+    std::vector<std::string> removed;
+};
+
 class MapRenderer {
 public:
     void SetWidth(double width);
@@ -95,53 +165,232 @@ public:
 
     void SetUnderLayerColor(const svg::Color& color);
     void SetColorPalette(const ColorArray& color_arr);
+    // Компактный вывод карты и тайлов: стили в <style>, округлённые координаты
+    void SetCompactOutput(const svg::CompactOptions& options);
+    // Допуск упрощения тайлов в пикселях, 0 - без упрощения. Полная карта не упрощается
+    void SetLodTolerance(double tolerance);
+    // Подпись, которая наложилась бы на размещённые ранее, переносится на другую
+    // сторону от точки или скрывается. Действует на карту и темы, но не на тайлы
+    void SetLabelPlacement(bool avoid_collisions);
+
+    // Оформление карты по умолчанию, с ним строятся карта и тайлы
+    const RenderStyle& GetStyle() const;
+    // Тема с тем же названием заменяется
+    void AddTheme(const std::string& name, const RenderStyle& style);
+    bool HasTheme(const std::string& name) const;
+    // Карта в оформлении темы. Устаревшие карты всех тем перестраиваются вместе,
+    // параллельно и по общему плану отрисовки: для темы заново выполняются
+    // только назначение стилей и вывод в svg
+    const std::string& GetThemeSvg(const std::string& name);
+    const std::string& GetThemeMap(const std::string& name);
+
+    // ETag карты: хэш содержимого справочника и настроек, от которых зависит карта.
+    // Считается без построения карты. Пустой theme - оформление по умолчанию
+    std::string GetETag(const std::string& theme) const;
+    // Изменения карты в оформлении по умолчанию с версии base_etag. Хранятся последние
+    // MAP_HISTORY_SIZE версий карты; nullopt, если версии нет в истории или карта
+    // строится без фрагментов (компактный вывод, размещение подписей)
+    std::optional<MapDelta> GetMapDelta(const std::string& base_etag);
 
+    // Запоминает справочник и строит по нему карту (в потоковом режиме - только запоминает).
+    // Готовая карта кэшируется и перестраивается при следующем обращении,
+    // если изменились справочник или настройки
     void SetMap(const transport_list::TransportCatalogue& catalog);
-    std::string GetMap() const;
+    // Карта с экранированием для вставки в строку JSON
+    const std::string& GetMap();
+    // Выводит карту с экранированием для JSON прямо в поток ответа
+    void PrintMap(std::ostream& out);
+    const std::string& GetSvg();
+    // Выводит карту без экранирования, в потоковом режиме - по мере построения
+    void PrintSvg(std::ostream& out);
     void RenderMap() const;
 
+    // Выводит карту в out по мере построения элементов, не сохраняя ни документ, ни фрагменты:
+    // кроме плана отрисовки в памяти находится только текущий элемент
+    void StreamMap(std::ostream& out);
+    // В потоковом режиме PrintMap строит карту через StreamMap при каждом вызове, минуя кэш
+    void SetStreaming(bool streaming);
+
+    // Тайл z/x/y размером с полную карту
+    Viewport GetTileViewport(int z, int x, int y) const;
+    // Область между географическими координатами, вписанная в размер карты
+    Viewport GetBoundsViewport(const geo::Coordinates& min, const geo::Coordinates& max);
+    // Svg-документ только с элементами карты, попадающими в область.
+    // Линии маршрутов обрезаются по границе области
+    std::string GetTileSvg(const Viewport& viewport);
+
+    // Число потоков для построения карты, по умолчанию - число ядер.
+    // Результат от числа потоков не зависит
+    void SetThreadCount(size_t count);
+
 private:
-    svg::Document map_;
+    // Маршрут и индекс его цвета в палитре
+    using BusColor = std::pair<const domain::Bus*, size_t>;
+    // Точки остановок на карте по номерам остановок в справочнике
+    using StopPoints = std::vector<svg::Point>;
+
+    // Индексы элементов карты: маршруты по отрезкам линий, остановки по точкам
+    struct TileIndex {
+        spatial::GridIndex buses;
+        spatial::GridIndex stops;
+    };
+
+    // Точки подписей маршрута: у начальной и, для некольцевого маршрута, у конечной остановки
+    struct BusLabelAnchors {
+        svg::Point start;
+        std::optional<svg::Point> last;
+    };
+
+    // Геометрия карты, упрощённая для одного уровня масштаба
+    struct LodLevel {
+        // Вершины линий маршрутов в координатах полной карты, по индексам RenderPlan::buses
+        std::vector<std::vector<svg::Point>> bus_lines;
+        // Остановки, не слившиеся с выведенными ранее, по индексам RenderPlan::stops
+        std::vector<bool> visible_stops;
+    };
+
+    // План отрисовки: всё, что зависит только от справочника, размеров карты, палитры
+    // и допуска упрощения. Строится один раз на версию справочника и переиспользуется
+    // при смене стилей, а также для тайлов
+    struct RenderPlan {
+        size_t catalog_version = 0;
+        size_t layout_version = 0;
+
+        // Маршруты в порядке вывода (по имени) с индексами цветов
+        std::vector<BusColor> buses;
+        std::vector<BusLabelAnchors> bus_labels;
+        // Остановки на маршрутах в порядке вывода (по имени)
+        std::vector<const domain::Stop*> stops;
+        std::optional<SphereProjector> projector;
+        // Меняется, только если новая проекция отличается от прежней
+        size_t projection_version = 0;
+        // Точки остановок, спроецированные один раз для всех слоёв и тайлов
+        StopPoints stop_points;
+        std::optional<TileIndex> tile_index;
+        // Уровни упрощения для тайлов по масштабу. Полная карта их не использует
+        std::map<int, LodLevel> lod_levels;
+    };
+
+    // Готовые svg-фрагменты элемента карты: линия и подписи маршрута или круг и подпись остановки
+    struct Fragments {
+        bool is_valid = false;
+        size_t color = 0;
+        std::string shape;
+        std::string label;
+        // Хэш shape и label для сравнения версий карты
+        uint64_t hash = 0;
+    };
+
+    // Фрагменты переживают перестроение карты, пока не изменились стили или проекция.
+    // Маршрут перерисовывается также при смене его цвета, остальные элементы
+    // справочника неизменяемы, поэтому новые маршруты и остановки рисуются по отдельности
+    struct FragmentCache {
+        const transport_list::TransportCatalogue* catalog = nullptr;
+        size_t settings_version = 0;
+        size_t projection_version = 0;
+        std::unordered_map<const domain::Bus*, Fragments> buses;
+        // По номерам остановок в справочнике
+        std::vector<Fragments> stops;
+    };
+
+    struct MapCache {
+        size_t catalog_version = 0;
+        size_t settings_version = 0;
+        std::string svg;
+        std::string escaped;
+    };
+
+    // Хэши элементов карты одной версии по ключам элементов
+    struct MapSnapshot {
+        std::string etag;
+        std::map<std::string, uint64_t> elements;
+    };
+
+    struct Theme {
+        RenderStyle style;
+        std::optional<MapCache> cache;
+    };
+
+    // Точки привязки подписей после устранения наложений, nullopt - подпись скрыта
+    struct LabelLayout {
+        // По две на маршрут: у начальной и у конечной остановки
+        std::vector<std::optional<svg::Point>> bus_labels;
+        // По индексам RenderPlan::stops
+        std::vector<std::optional<svg::Point>> stop_labels;
+    };
+
+    const transport_list::TransportCatalogue* catalog_ = nullptr;
+    size_t settings_version_ = 0;
+    // Увеличивается при изменении настроек, от которых зависит план отрисовки
+    size_t layout_version_ = 0;
+    std::optional<RenderPlan> plan_;
+    std::optional<MapCache> cache_;
+    std::map<std::string, Theme> themes_;
+    FragmentCache fragments_;
+    std::deque<MapSnapshot> history_;
+    size_t thread_count_ = 0;
+    bool streaming_ = false;
+    bool avoid_label_collisions_ = false;
 
     double width_ = 0;
     double height_ = 0;
     double padding_ = 0;
-    double stop_radius_ = 1;
-    double line_width_ = 1;
-    double underlayer_width_ = 0;
+    double lod_tolerance_ = 0.5;
+    std::optional<svg::CompactOptions> compact_output_;
 
-    int bus_label_font_size_ = 1;
-    int stop_label_font_size_ = 1;
+    RenderStyle style_;
 
-    std::vector<double> bus_label_offset_;
-    std::vector<double> stop_label_offset_;
+    void BuildPlan();
+    RenderPlan& GetPlan();
+    // Перерисовывает устаревшие фрагменты и собирает из фрагментов документ
+    void BuildMap();
+    // Перерисовывает устаревшие фрагменты и запоминает версию карты для GetMapDelta
+    void UpdateFragments(const RenderPlan& plan);
+    MapCache& GetCache();
+    void SaveSnapshot(const RenderPlan& plan);
+    bool IsActual(const std::optional<MapCache>& cache) const;
+    void BuildThemes();
+    Theme& GetTheme(const std::string& name);
+    // Выводит всю карту по плану в оформлении style, элемент за элементом
+    void WriteMap(std::ostream& out, const RenderPlan& plan, const RenderStyle& style) const;
+    // Жадное размещение: подписи маршрутов, затем остановок, в порядке вывода
+    LabelLayout PlaceLabels(const RenderPlan& plan, const RenderStyle& style) const;
+    const TileIndex& GetTileIndex(RenderPlan& plan) const;
+    // Уровень строится при первом запросе тайла с этим масштабом и хранится в плане,
+    // поэтому тайлам не нужна собранная полная карта
+    const LodLevel& GetLodLevel(RenderPlan& plan, int zoom) const;
 
-    svg::Color underlayer_color_;
-    ColorArray color_palette_;
-
-    void SetBuses(const std::map<std::string_view, domain::Bus*> buses,
-                  const SphereProjector& projector);
-    void SetBusesLabel(const std::map<std::string_view, domain::Bus*> buses,
-                       const SphereProjector& projector);
-    void SetBusesStops(const std::set<domain::Stop*> stops,
-                       const SphereProjector& projector);
-    void SetBusesStopsLabel(const std::set<domain::Stop*> stops,
-                            const SphereProjector& projector);
+    // Слои карты строятся по частям: каждый вызов добавляет в контейнер
+    // элементы одного маршрута или одной остановки в оформлении style
+    void AddBusLine(svg::ObjectContainer& container, const RenderStyle& style,
+                    const BusColor& bus, const StopPoints& points) const;
+    // Части линии внутри clip, каждая часть - отдельная ломаная
+    void AddClippedBusLine(svg::ObjectContainer& container, const RenderStyle& style,
+                           const std::vector<svg::Point>& line, size_t color,
+                           const spatial::Rect& clip) const;
+    void AddBusLabel(svg::ObjectContainer& container, const RenderStyle& style,
+                     const BusColor& bus, const BusLabelAnchors& anchors) const;
+    void AddBusLabelAt(svg::ObjectContainer& container, const RenderStyle& style,
+                       const BusColor& bus, svg::Point point) const;
+    void AddStopCircle(svg::ObjectContainer& container, const RenderStyle& style,
+                       svg::Point point) const;
+    void AddStopLabel(svg::ObjectContainer& container, const RenderStyle& style,
+                      const domain::Stop* stop, svg::Point point) const;
 
     svg::Polyline CreateBusLine(const domain::Bus* bus,
-                                const SphereProjector& projector);
-
-    svg::Text GetUnderlayerTextBus(const domain::Bus* bus,
-                                const domain::Stop* stop,
-                                   const SphereProjector& projector);
-    svg::Text GetTextBus(const domain::Bus* bus,
-                      const domain::Stop* stop, size_t color_count,
-                         const SphereProjector& projector);
-
-    svg::Text GetUnderlayerTextStop(const domain::Stop* stop,
-                                    const SphereProjector& projector);
-    svg::Text GetTextStop(const domain::Stop* stop,
-                          const SphereProjector& projector);
+                                const StopPoints& points) const;
+    svg::Polyline& SetBusLineStyle(svg::Polyline& polyline, const RenderStyle& style,
+                                   size_t color) const;
+
+    svg::Text GetUnderlayerTextBus(const RenderStyle& style, const domain::Bus* bus,
+                                   svg::Point point) const;
+    svg::Text GetTextBus(const RenderStyle& style, const domain::Bus* bus, size_t color_count,
+                         svg::Point point) const;
+
+    svg::Text GetUnderlayerTextStop(const RenderStyle& style, const domain::Stop* stop,
+                                    svg::Point point) const;
+    svg::Text GetTextStop(const RenderStyle& style, const domain::Stop* stop,
+                          svg::Point point) const;
 };
 
 }
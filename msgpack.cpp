@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include "msgpack.h"
+
+using namespace std;
+
+namespace msgpack {
+
+namespace {
+
+using json::Array;
+using json::Dict;
+using json::Node;
+using json::ParsingError;
+
+uint8_t ReadByte(istream& input) {
+    int c = input.get();
+    if(c == char_traits<char>::eof()) {
+        throw ParsingError("msgpack error - unexpected end of stream"s);
+    }
+    return static_cast<uint8_t>(c);
+}
+
+// Целые в MessagePack записываются в порядке big-endian
+uint64_t ReadBigEndian(istream& input, size_t size) {
+    uint64_t result = 0;
+    for(size_t i = 0; i < size; ++i) {
+        result = (result << 8) | ReadByte(input);
+    }
+    return result;
+}
+
+Node MakeInt(int64_t value) {
+    if(value >= numeric_limits<int>::min() && value <= numeric_limits<int>::max()) {
+        return Node(static_cast<int>(value));
+    }
+    return Node(static_cast<double>(value));
+}
+
+// Длины строк и массивов берутся из входа и не проверены, поэтому память под них
+// выделяется частями не больше этих: обрезанный или испорченный документ
+// обнаруживается раньше, чем выделено много памяти
+const size_t MAX_STRING_CHUNK = 1 << 16;
+const size_t MAX_ARRAY_RESERVE = 1 << 12;
+
+Node LoadNode(istream& input);
+
+string LoadString(istream& input, size_t size) {
+    string result;
+    while(result.size() < size) {
+        size_t offset = result.size();
+        result.resize(offset + min(size - offset, MAX_STRING_CHUNK));
+        if(!input.read(result.data() + offset, result.size() - offset)) {
+            throw ParsingError("msgpack error - string is truncated"s);
+        }
+    }
+    return result;
+}
+
+Node LoadArray(istream& input, size_t size) {
+    Array result;
+    result.reserve(min(size, MAX_ARRAY_RESERVE));
+    for(size_t i = 0; i < size; ++i) {
+        result.push_back(LoadNode(input));
+    }
+    return Node(move(result));
+}
+
+Node LoadDict(istream& input, size_t size) {
+    Dict result;
+    for(size_t i = 0; i < size; ++i) {
+        Node key = LoadNode(input);
+        if(!key.IsString()) {
+            throw ParsingError("msgpack error - map key is not a string"s);
+        }
+        Node value = LoadNode(input);
+        result.insert({key.AsString(), move(value)});
+    }
+    return Node(move(result));
+}
+
+Node LoadNode(istream& input) {
+    uint8_t c = ReadByte(input);
+
+    if(c <= 0x7f) {
+        return Node(static_cast<int>(c));
+    }
+    if(c >= 0xe0) {
+        return Node(static_cast<int>(static_cast<int8_t>(c)));
+    }
+    if((c & 0xf0) == 0x80) {
+        return LoadDict(input, c & 0x0f);
+    }
+    if((c & 0xf0) == 0x90) {
+        return LoadArray(input, c & 0x0f);
+    }
+    if((c & 0xe0) == 0xa0) {
+        return Node(LoadString(input, c & 0x1f));
+    }
+
+    switch(c) {
+    case 0xc0: return Node(nullptr);
+    case 0xc2: return Node(false);
+    case 0xc3: return Node(true);
+    case 0xc4:
+    case 0xd9: return Node(LoadString(input, ReadBigEndian(input, 1)));
+    case 0xc5:
+    case 0xda: return Node(LoadString(input, ReadBigEndian(input, 2)));
+    case 0xc6:
+    case 0xdb: return Node(LoadString(input, ReadBigEndian(input, 4)));
+    case 0xca: {
+        uint32_t bits = static_cast<uint32_t>(ReadBigEndian(input, 4));
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return Node(static_cast<double>(value));
+    }
+    case 0xcb: {
+        uint64_t bits = ReadBigEndian(input, 8);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return Node(value);
+    }
+    case 0xcc: return MakeInt(ReadBigEndian(input, 1));
+    case 0xcd: return MakeInt(ReadBigEndian(input, 2));
+    case 0xce: return MakeInt(ReadBigEndian(input, 4));
+    case 0xcf: {
+        uint64_t value = ReadBigEndian(input, 8);
+        if(value > static_cast<uint64_t>(numeric_limits<int64_t>::max())) {
+            return Node(static_cast<double>(value));
+        }
+        return MakeInt(static_cast<int64_t>(value));
+    }
+    case 0xd0: return MakeInt(static_cast<int8_t>(ReadBigEndian(input, 1)));
+    case 0xd1: return MakeInt(static_cast<int16_t>(ReadBigEndian(input, 2)));
+    case 0xd2: return MakeInt(static_cast<int32_t>(ReadBigEndian(input, 4)));
+    case 0xd3: return MakeInt(static_cast<int64_t>(ReadBigEndian(input, 8)));
+    case 0xdc: return LoadArray(input, ReadBigEndian(input, 2));
+    case 0xdd: return LoadArray(input, ReadBigEndian(input, 4));
+    case 0xde: return LoadDict(input, ReadBigEndian(input, 2));
+    case 0xdf: return LoadDict(input, ReadBigEndian(input, 4));
+    default:
+        throw ParsingError("msgpack error - unsupported type byte "s + to_string(c));
+    }
+}
+
+class Printer {
+public:
+    explicit Printer(ostream& out)
+        : out_(out) {
+    }
+
+    void PrintNode(const Node& node) {
+        if(node.IsNull()) {
+            PutByte(0xc0);
+        } else if(node.IsBool()) {
+            PutByte(node.AsBool() ? 0xc3 : 0xc2);
+        } else if(node.IsInt()) {
+            PrintInt(node.AsInt());
+        } else if(node.IsPureDouble()) {
+            PrintDouble(node.AsDouble());
+        } else if(node.IsString()) {
+            PrintString(node.AsString());
+        } else if(node.IsArray()) {
+            PrintArray(node.AsArray());
+        } else if(node.IsMap()) {
+            PrintDict(node.AsMap());
+        }
+    }
+
+    void PrintArrayHeader(size_t size) {
+        PutHeader(size, 0x90, 15, 0, 0xdc, 0xdd);
+    }
+
+    void PrintDictHeader(size_t size) {
+        PutHeader(size, 0x80, 15, 0, 0xde, 0xdf);
+    }
+
+    // У bin нет короткой формы, поэтому bin 8 выводится и для пустых данных
+    void PrintBinary(string_view data) {
+        if(data.size() <= 0xff) {
+            PutByte(0xc4);
+            PutBigEndian(data.size(), 1);
+        } else {
+            PutHeader(data.size(), 0, 0, 0, 0xc5, 0xc6);
+        }
+        out_.write(data.data(), data.size());
+    }
+
+private:
+    ostream& out_;
+
+    void PutByte(uint8_t c) {
+        out_.put(static_cast<char>(c));
+    }
+
+    void PutBigEndian(uint64_t value, size_t size) {
+        char buf[8];
+        for(size_t i = 0; i < size; ++i) {
+            buf[size - 1 - i] = static_cast<char>(value & 0xff);
+            value >>= 8;
+        }
+        out_.write(buf, size);
+    }
+
+    // Заголовок str, array или map: короткая форма с длиной в младших битах
+    // либо маркер и длина в 1, 2 или 4 байтах
+    void PutHeader(size_t size, uint8_t fix, size_t fix_max,
+                   uint8_t marker8, uint8_t marker16, uint8_t marker32) {
+        if(size <= fix_max) {
+            PutByte(fix | static_cast<uint8_t>(size));
+        } else if(marker8 && size <= 0xff) {
+            PutByte(marker8);
+            PutBigEndian(size, 1);
+        } else if(size <= 0xffff) {
+            PutByte(marker16);
+            PutBigEndian(size, 2);
+        } else {
+            PutByte(marker32);
+            PutBigEndian(size, 4);
+        }
+    }
+
+    void PrintInt(int value) {
+        if(value >= 0) {
+            if(value <= 0x7f) {
+                PutByte(static_cast<uint8_t>(value));
+            } else if(value <= 0xff) {
+                PutByte(0xcc);
+                PutBigEndian(value, 1);
+            } else if(value <= 0xffff) {
+                PutByte(0xcd);
+                PutBigEndian(value, 2);
+            } else {
+                PutByte(0xce);
+                PutBigEndian(value, 4);
+            }
+        } else if(value >= -32) {
+            PutByte(static_cast<uint8_t>(static_cast<int8_t>(value)));
+        } else if(value >= numeric_limits<int8_t>::min()) {
+            PutByte(0xd0);
+            PutBigEndian(static_cast<uint8_t>(value), 1);
+        } else if(value >= numeric_limits<int16_t>::min()) {
+            PutByte(0xd1);
+            PutBigEndian(static_cast<uint16_t>(value), 2);
+        } else {
+            PutByte(0xd2);
+            PutBigEndian(static_cast<uint32_t>(value), 4);
+        }
+    }
+
+    void PrintDouble(double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        PutByte(0xcb);
+        PutBigEndian(bits, 8);
+    }
+
+    void PrintString(const string& str) {
+        PutHeader(str.size(), 0xa0, 31, 0xd9, 0xda, 0xdb);
+        out_.write(str.data(), str.size());
+    }
+
+    void PrintArray(const Array& arr) {
+        PrintArrayHeader(arr.size());
+        for(const auto& item : arr) {
+            PrintNode(item);
+        }
+    }
+
+    void PrintDict(const Dict& dict) {
+        PrintDictHeader(dict.size());
+        for(const auto& [key, value] : dict) {
+            PrintString(key);
+            PrintNode(value);
+        }
+    }
+};
+
+}  // namespace
+
+bool IsMsgPack(istream& input) {
+    int c = input.peek();
+    if(c == char_traits<char>::eof()) {
+        return false;
+    }
+    uint8_t byte = static_cast<uint8_t>(c);
+    return (byte & 0xe0) == 0x80 || (byte >= 0xdc && byte <= 0xdf);
+}
+
+json::Document Load(istream& input) {
+    return json::Document{LoadNode(input)};
+}
+
+void Print(const json::Document& doc, ostream& output) {
+    Printer{output}.PrintNode(doc.GetRoot());
+}
+
+void PrintArrayBegin(size_t size, ostream& output) {
+    Printer{output}.PrintArrayHeader(size);
+}
+
+void PrintDictBegin(size_t size, ostream& output) {
+    Printer{output}.PrintDictHeader(size);
+}
+
+void PrintBinary(string_view data, ostream& output) {
+    Printer{output}.PrintBinary(data);
+}
+
+}  // namespace msgpack
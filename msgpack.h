@@ -0,0 +1,33 @@
+#pragma once
+
+#include <iostream>
+#include <string_view>
+
+#include "json.h"
+
+/*
+ * Двоичный формат MessagePack (https://msgpack.org/) для тех же деревьев json::Node,
+ * что строит и печатает модуль json. Поддерживаются nil, bool, целые, float32/float64,
+ * str, bin (читается как строка), array и map со строковыми ключами.
+ */
+
+namespace msgpack {
+
+// Проверяет по первому байту потока, что в нём документ MessagePack, а не текст JSON.
+// Корнем JSON-документа может быть только '{', '[' или пробельный символ перед ними,
+// а корнем MessagePack - map или array, байты которых не пересекаются с ASCII.
+bool IsMsgPack(std::istream& input);
+
+// При ошибках разбора выбрасывает json::ParsingError
+json::Document Load(std::istream& input);
+
+void Print(const json::Document& doc, std::ostream& output);
+
+// Выводит заголовок массива из size элементов, сами элементы выводятся следом через Print
+void PrintArrayBegin(size_t size, std::ostream& output);
+// Выводит заголовок словаря из size пар, ключи и значения выводятся следом через Print
+void PrintDictBegin(size_t size, std::ostream& output);
+// Выводит двоичные данные типом bin, которого нет среди узлов json::Node
+void PrintBinary(std::string_view data, std::ostream& output);
+
+}  // namespace msgpack
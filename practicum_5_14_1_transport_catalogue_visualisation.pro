@@ -1,25 +1,37 @@
 TEMPLATE = app
-CONFIG += console c++17
+CONFIG += console c++17 thread
 CONFIG -= app_bundle
 CONFIG -= qt
 
+LIBS += -lz
+
 SOURCES += \
+        compression.cpp \
         domain.cpp \
+        encoding.cpp \
         geo.cpp \
         json.cpp \
         json_reader.cpp \
+        msgpack.cpp \
         main.cpp \
         map_renderer.cpp \
         request_handler.cpp \
+        request_schema.cpp \
+        spatial_index.cpp \
         svg.cpp \
         transport_catalogue.cpp
 
 HEADERS += \
+    compression.h \
     domain.h \
+    encoding.h \
     geo.h \
     json.h \
     json_reader.h \
+    msgpack.h \
     map_renderer.h \
     request_handler.h \
+    request_schema.h \
+    spatial_index.h \
     svg.h \
     transport_catalogue.h
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "request_schema.h"
+
+namespace schema {
+
+using namespace std::literals;
+
+namespace {
+
+template <typename Request>
+void SortByName(std::vector<Request>& requests) {
+    std::sort(requests.begin(),
+              requests.end(),
+              [](const Request& lhs, const Request& rhs) {
+                    return lhs.name < rhs.name;
+                });
+}
+
+TileCoords& GetTile(StatRequest& request) {
+    if(!request.tile) {
+        request.tile.emplace();
+    }
+    return *request.tile;
+}
+
+GeoBounds& GetBounds(StatRequest& request) {
+    if(!request.bounds) {
+        request.bounds.emplace();
+    }
+    return *request.bounds;
+}
+
+// Неизвестный формат отклоняется, как и значение неверного типа: клиент ждёт
+// сжатую карту и не должен молча получить несжатую
+compression::Encoding GetEncoding(const std::string& name) {
+    if(auto encoding = compression::ParseEncoding(name)) {
+        return *encoding;
+    }
+    throw std::logic_error("unknown compression "s + name);
+}
+
+}
+
+BaseRequests ParseBaseRequests(const json::Array& requests) {
+    BaseRequests result;
+
+    for(const auto& request : requests) {
+        RequestType type = RequestType::UNKNOWN;
+        StopRequest stop;
+        BusRequest bus;
+
+        for(const auto& [key, value] : request.AsMap()) {
+            switch(GetField(key)) {
+            case Field::TYPE:
+                type = GetRequestType(value.AsString());
+                break;
+            case Field::NAME:
+                stop.name = value.AsString();
+                break;
+            case Field::LATITUDE:
+                stop.latitude = value.AsDouble();
+                break;
+            case Field::LONGITUDE:
+                stop.longitude = value.AsDouble();
+                break;
+            case Field::ROAD_DISTANCES:
+                for(const auto& [to, distance] : value.AsMap()) {
+                    stop.road_distances.push_back({to, distance.AsInt()});
+                }
+                break;
+            case Field::STOPS:
+                for(const auto& item : value.AsArray()) {
+                    bus.stops.push_back(item.AsString());
+                }
+                break;
+            case Field::IS_ROUNDTRIP:
+                bus.is_roundtrip = value.AsBool();
+                break;
+            default:
+                break;
+            }
+        }
+
+        if(type == RequestType::STOP) {
+            result.stops.push_back(std::move(stop));
+        } else if(type == RequestType::BUS) {
+            bus.name = std::move(stop.name);
+            result.buses.push_back(std::move(bus));
+        }
+    }
+
+    SortByName(result.stops);
+    SortByName(result.buses);
+
+    return result;
+}
+
+std::vector<StatRequest> ParseStatRequests(const json::Array& requests) {
+    std::vector<StatRequest> result;
+    result.reserve(requests.size());
+
+    for(const auto& request : requests) {
+        StatRequest stat;
+
+        for(const auto& [key, value] : request.AsMap()) {
+            switch(GetField(key)) {
+            case Field::ID:
+                stat.id = value.AsInt();
+                break;
+            case Field::TYPE:
+                stat.type = GetRequestType(value.AsString());
+                break;
+            case Field::NAME:
+                stat.name = value.AsString();
+                break;
+            case Field::Z:
+                GetTile(stat).z = value.AsInt();
+                break;
+            case Field::X:
+                GetTile(stat).x = value.AsInt();
+                break;
+            case Field::Y:
+                GetTile(stat).y = value.AsInt();
+                break;
+            case Field::MIN_LAT:
+                GetBounds(stat).min_lat = value.AsDouble();
+                break;
+            case Field::MIN_LNG:
+                GetBounds(stat).min_lng = value.AsDouble();
+                break;
+            case Field::MAX_LAT:
+                GetBounds(stat).max_lat = value.AsDouble();
+                break;
+            case Field::MAX_LNG:
+                GetBounds(stat).max_lng = value.AsDouble();
+                break;
+            case Field::COMPRESSION:
+                stat.compression = GetEncoding(value.AsString());
+                break;
+            case Field::THEME:
+                stat.theme = value.AsString();
+                break;
+            case Field::IF_NONE_MATCH:
+                stat.if_none_match = value.AsString();
+                break;
+            case Field::BASE_VERSION:
+                stat.base_version = value.AsString();
+                break;
+            case Field::FROM:
+                stat.from = value.AsInt();
+                break;
+            case Field::TO:
+                stat.to = value.AsInt();
+                break;
+            default:
+                break;
+            }
+        }
+
+        result.push_back(std::move(stat));
+    }
+
+    return result;
+}
+
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "encoding.h"
+#include "json.h"
+
+/*
+ * Схема запросов к транспортному справочнику.
+ * Каждый объект запроса разбирается за один проход по его полям в типизированную структуру.
+ * Тип запроса и имена полей распознаются оператором switch по хэшу, вычисленному
+ * на этапе компиляции: совпадение хэшей двух имён схемы даёт ошибку компиляции
+ * (повторяющаяся метка case), поэтому хэш для таблицы схемы совершенный.
+ */
+
+namespace schema {
+
+enum class RequestType {
+    UNKNOWN,
+    STOP,
+    BUS,
+    MAP,
+    MAP_TILE,
+    BUS_SEGMENT,
+};
+
+enum class Field {
+    UNKNOWN,
+    ID,
+    TYPE,
+    NAME,
+    LATITUDE,
+    LONGITUDE,
+    ROAD_DISTANCES,
+    STOPS,
+    IS_ROUNDTRIP,
+    Z,
+    X,
+    Y,
+    MIN_LAT,
+    MIN_LNG,
+    MAX_LAT,
+    MAX_LNG,
+    COMPRESSION,
+    THEME,
+    IF_NONE_MATCH,
+    BASE_VERSION,
+    FROM,
+    TO,
+};
+
+// FNV-1a
+constexpr uint32_t Hash(std::string_view str) {
+    uint32_t hash = 2166136261u;
+    for(char c : str) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+namespace detail {
+    template <typename Enum>
+    constexpr Enum Match(std::string_view key, std::string_view name, Enum value) {
+        return key == name ? value : Enum::UNKNOWN;
+    }
+}
+
+constexpr RequestType GetRequestType(std::string_view type) {
+    using detail::Match;
+    switch(Hash(type)) {
+    case Hash("Stop"): return Match(type, "Stop", RequestType::STOP);
+    case Hash("Bus"):  return Match(type, "Bus", RequestType::BUS);
+    case Hash("Map"):  return Match(type, "Map", RequestType::MAP);
+    case Hash("MapTile"): return Match(type, "MapTile", RequestType::MAP_TILE);
+    case Hash("BusSegment"): return Match(type, "BusSegment", RequestType::BUS_SEGMENT);
+    default:           return RequestType::UNKNOWN;
+    }
+}
+
+constexpr Field GetField(std::string_view key) {
+    using detail::Match;
+    switch(Hash(key)) {
+    case Hash("id"):             return Match(key, "id", Field::ID);
+    case Hash("type"):           return Match(key, "type", Field::TYPE);
+    case Hash("name"):           return Match(key, "name", Field::NAME);
+    case Hash("latitude"):       return Match(key, "latitude", Field::LATITUDE);
+    case Hash("longitude"):      return Match(key, "longitude", Field::LONGITUDE);
+    case Hash("road_distances"): return Match(key, "road_distances", Field::ROAD_DISTANCES);
+    case Hash("stops"):          return Match(key, "stops", Field::STOPS);
+    case Hash("is_roundtrip"):   return Match(key, "is_roundtrip", Field::IS_ROUNDTRIP);
+    case Hash("z"):              return Match(key, "z", Field::Z);
+    case Hash("x"):              return Match(key, "x", Field::X);
+    case Hash("y"):              return Match(key, "y", Field::Y);
+    case Hash("min_lat"):        return Match(key, "min_lat", Field::MIN_LAT);
+    case Hash("min_lng"):        return Match(key, "min_lng", Field::MIN_LNG);
+    case Hash("max_lat"):        return Match(key, "max_lat", Field::MAX_LAT);
+    case Hash("max_lng"):        return Match(key, "max_lng", Field::MAX_LNG);
+    case Hash("compression"):    return Match(key, "compression", Field::COMPRESSION);
+    case Hash("theme"):          return Match(key, "theme", Field::THEME);
+    case Hash("if_none_match"):  return Match(key, "if_none_match", Field::IF_NONE_MATCH);
+    case Hash("base_version"):   return Match(key, "base_version", Field::BASE_VERSION);
+    case Hash("from"):           return Match(key, "from", Field::FROM);
+    case Hash("to"):             return Match(key, "to", Field::TO);
+    default:                     return Field::UNKNOWN;
+    }
+}
+
+struct StopRequest {
+    std::string name;
+    double latitude = 0;
+    double longitude = 0;
+    std::vector<std::pair<std::string, int>> road_distances;
+};
+
+struct BusRequest {
+    std::string name;
+    std::vector<std::string> stops;
+    bool is_roundtrip = false;
+};
+
+// Тайл запроса MapTile: на уровне z карта делится на 2^z x 2^z тайлов
+struct TileCoords {
+    int z = 0;
+    int x = 0;
+    int y = 0;
+};
+
+// Область запроса MapTile в географических координатах
+struct GeoBounds {
+    double min_lat = 0;
+    double min_lng = 0;
+    double max_lat = 0;
+    double max_lng = 0;
+};
+
+struct StatRequest {
+    int id = 0;
+    RequestType type = RequestType::UNKNOWN;
+    std::string name;
+    // Для MapTile задаётся либо тайл, либо область
+    std::optional<TileCoords> tile;
+    std::optional<GeoBounds> bounds;
+    // Для Map и MapTile: карта сжимается и передаётся в base64 (JSON) или типом bin (MessagePack)
+    compression::Encoding compression = compression::Encoding::NONE;
+    // Для Map: тема из render_settings.themes, пустая - оформление по умолчанию
+    std::string theme;
+    // Для Map: ETag карты, полученной ранее. Если поле задано, в ответе есть ETag текущей карты,
+    // а при совпадении вместо карты возвращается "not_modified". Пустая строка ни с чем не совпадает
+    std::optional<std::string> if_none_match;
+    // Для Map без темы: ETag карты у клиента. Если эта версия ещё хранится, в ответе
+    // только изменившиеся элементы, иначе - вся карта с ETag
+    std::optional<std::string> base_version;
+    // Для BusSegment: номера первой и последней остановок участка маршрута name,
+    // считая с нуля. Некольцевой маршрут нумеруется вместе с обратным направлением.
+    // Без любого из них ответ - "not found"
+    std::optional<int> from;
+    std::optional<int> to;
+};
+
+struct BaseRequests {
+    std::vector<StopRequest> stops;
+    std::vector<BusRequest> buses;
+};
+
+// Разбирает массив base_requests, остановки и маршруты возвращаются отсортированными по имени
+BaseRequests ParseBaseRequests(const json::Array& requests);
+
+// Разбирает массив stat_requests с сохранением порядка запросов.
+// Значение неверного типа или неизвестный формат сжатия - std::logic_error
+std::vector<StatRequest> ParseStatRequests(const json::Array& requests);
+
+}
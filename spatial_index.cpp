@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cmath>
+
+#include "spatial_index.h"
+
+namespace spatial {
+
+Rect Rect::FromPoints(svg::Point a, svg::Point b) {
+    return {std::min(a.x, b.x), std::min(a.y, b.y),
+            std::max(a.x, b.x), std::max(a.y, b.y)};
+}
+
+Rect Rect::Expanded(double margin) const {
+    return {min_x - margin, min_y - margin, max_x + margin, max_y + margin};
+}
+
+Rect Rect::ClampedTo(const Rect& other) const {
+    return {std::clamp(min_x, other.min_x, other.max_x), std::clamp(min_y, other.min_y, other.max_y),
+            std::clamp(max_x, other.min_x, other.max_x), std::clamp(max_y, other.min_y, other.max_y)};
+}
+
+bool Rect::Contains(const Rect& other) const {
+    return other.min_x >= min_x && other.max_x <= max_x
+            && other.min_y >= min_y && other.max_y <= max_y;
+}
+
+bool Rect::Contains(svg::Point point) const {
+    return point.x >= min_x && point.x <= max_x
+            && point.y >= min_y && point.y <= max_y;
+}
+
+bool Rect::Intersects(const Rect& other) const {
+    return min_x <= other.max_x && other.min_x <= max_x
+            && min_y <= other.max_y && other.min_y <= max_y;
+}
+
+bool ClipSegment(const Rect& rect, svg::Point& from, svg::Point& to) {
+    double dx = to.x - from.x;
+    double dy = to.y - from.y;
+    double t_min = 0;
+    double t_max = 1;
+
+    // Для каждой стороны: p * t <= q
+    const double p[] = {-dx, dx, -dy, dy};
+    const double q[] = {from.x - rect.min_x, rect.max_x - from.x,
+                        from.y - rect.min_y, rect.max_y - from.y};
+
+    for(int i = 0; i < 4; ++i) {
+        if(p[i] == 0) {
+            if(q[i] < 0) {
+                return false;
+            }
+            continue;
+        }
+
+        double t = q[i] / p[i];
+        if(p[i] < 0) {
+            t_min = std::max(t_min, t);
+        } else {
+            t_max = std::min(t_max, t);
+        }
+
+        if(t_min > t_max) {
+            return false;
+        }
+    }
+
+    svg::Point start = from;
+    if(t_min > 0) {
+        from = {start.x + t_min * dx, start.y + t_min * dy};
+    }
+    if(t_max < 1) {
+        to = {start.x + t_max * dx, start.y + t_max * dy};
+    }
+    return true;
+}
+
+namespace {
+
+double SegmentDistance(svg::Point point, svg::Point a, svg::Point b) {
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+    double length2 = dx * dx + dy * dy;
+
+    double t = 0;
+    if(length2 > 0) {
+        t = std::clamp(((point.x - a.x) * dx + (point.y - a.y) * dy) / length2, 0.0, 1.0);
+    }
+    return std::hypot(point.x - (a.x + t * dx), point.y - (a.y + t * dy));
+}
+
+}
+
+std::vector<svg::Point> Simplify(const std::vector<svg::Point>& points, double tolerance) {
+    if(points.size() < 3 || tolerance <= 0) {
+        return points;
+    }
+
+    std::vector<bool> keep(points.size(), false);
+    keep.front() = true;
+    keep.back() = true;
+
+    // Отрезки обрабатываются через стек, чтобы длинные маршруты не упирались в глубину рекурсии
+    std::vector<std::pair<size_t, size_t>> ranges{{0, points.size() - 1}};
+    while(!ranges.empty()) {
+        auto [first, last] = ranges.back();
+        ranges.pop_back();
+
+        double max_distance = 0;
+        size_t farthest = first;
+        for(size_t i = first + 1; i < last; ++i) {
+            double distance = SegmentDistance(points[i], points[first], points[last]);
+            if(distance > max_distance) {
+                max_distance = distance;
+                farthest = i;
+            }
+        }
+
+        if(max_distance > tolerance) {
+            keep[farthest] = true;
+            ranges.push_back({first, farthest});
+            ranges.push_back({farthest, last});
+        }
+    }
+
+    std::vector<svg::Point> result;
+    for(size_t i = 0; i < points.size(); ++i) {
+        if(keep[i]) {
+            result.push_back(points[i]);
+        }
+    }
+    return result;
+}
+
+GridIndex::GridIndex(const Rect& bounds, size_t item_count)
+    : bounds_(bounds) {
+    double width = std::max(bounds.max_x - bounds.min_x, 1.0);
+    double height = std::max(bounds.max_y - bounds.min_y, 1.0);
+
+    double cell_size = std::sqrt(width * height / std::max<size_t>(item_count, 1));
+    cols_ = std::clamp<size_t>(static_cast<size_t>(width / cell_size), 1, 1024);
+    rows_ = std::clamp<size_t>(static_cast<size_t>(height / cell_size), 1, 1024);
+    cell_width_ = width / cols_;
+    cell_height_ = height / rows_;
+    cells_.resize(cols_ * rows_);
+}
+
+size_t GridIndex::GetColumn(double x) const {
+    double col = std::floor((x - bounds_.min_x) / cell_width_);
+    return static_cast<size_t>(std::clamp(col, 0.0, static_cast<double>(cols_ - 1)));
+}
+
+size_t GridIndex::GetRow(double y) const {
+    double row = std::floor((y - bounds_.min_y) / cell_height_);
+    return static_cast<size_t>(std::clamp(row, 0.0, static_cast<double>(rows_ - 1)));
+}
+
+void GridIndex::Insert(size_t id, const Rect& rect) {
+    for(size_t row = GetRow(rect.min_y), last_row = GetRow(rect.max_y); row <= last_row; ++row) {
+        for(size_t col = GetColumn(rect.min_x), last_col = GetColumn(rect.max_x); col <= last_col; ++col) {
+            auto& cell = cells_[row * cols_ + col];
+            if(cell.empty() || cell.back() != id) {
+                cell.push_back(id);
+            }
+        }
+    }
+}
+
+std::vector<size_t> GridIndex::Query(const Rect& rect) const {
+    std::vector<size_t> result;
+    if(!rect.Intersects(bounds_)) {
+        return result;
+    }
+
+    for(size_t row = GetRow(rect.min_y), last_row = GetRow(rect.max_y); row <= last_row; ++row) {
+        for(size_t col = GetColumn(rect.min_x), last_col = GetColumn(rect.max_x); col <= last_col; ++col) {
+            const auto& cell = cells_[row * cols_ + col];
+            result.insert(result.end(), cell.begin(), cell.end());
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+PlacementGrid::PlacementGrid(const Rect& bounds, size_t item_count)
+    : bounds_(bounds)
+    , index_(bounds, item_count) {
+    rects_.reserve(item_count);
+}
+
+bool PlacementGrid::TryPlace(const Rect& rect) {
+    // Insert кладёт прямоугольники за границами в крайние ячейки, а Query
+    // за границами ничего не находит, поэтому запрос прижимается к сетке
+    for(size_t id : index_.Query(rect.ClampedTo(bounds_))) {
+        if(rects_[id].Intersects(rect)) {
+            return false;
+        }
+    }
+
+    index_.Insert(rects_.size(), rect);
+    rects_.push_back(rect);
+    return true;
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+
+#include "svg.h"
+
+/*
+ * Пространственный индекс элементов карты в координатах svg-документа
+ */
+
+namespace spatial {
+
+struct Rect {
+    double min_x = 0;
+    double min_y = 0;
+    double max_x = 0;
+    double max_y = 0;
+
+    static Rect FromPoints(svg::Point a, svg::Point b);
+
+    Rect Expanded(double margin) const;
+    // Прямоугольник, прижатый к other: вне other он вырождается в отрезок или точку на его границе
+    Rect ClampedTo(const Rect& other) const;
+    bool Contains(svg::Point point) const;
+    bool Contains(const Rect& other) const;
+    bool Intersects(const Rect& other) const;
+};
+
+// Отсекает отрезок [from, to] прямоугольником rect (алгоритм Лианга-Барски).
+// Возвращает false, если отрезок не пересекает прямоугольник
+bool ClipSegment(const Rect& rect, svg::Point& from, svg::Point& to);
+
+// Упрощает ломаную алгоритмом Дугласа-Пекера: удалённые вершины отстоят
+// от упрощённой линии не больше чем на tolerance. Первая и последняя вершины сохраняются
+std::vector<svg::Point> Simplify(const std::vector<svg::Point>& points, double tolerance);
+
+// Равномерная сетка поверх bounds. Объект попадает во все ячейки,
+// которые пересекает его прямоугольник
+class GridIndex {
+public:
+    // Размер ячеек подбирается так, чтобы на ячейку приходилось около одного объекта
+    GridIndex(const Rect& bounds, size_t item_count);
+
+    void Insert(size_t id, const Rect& rect);
+
+    // Возвращает по возрастанию и без повторов идентификаторы объектов из ячеек,
+    // пересекающих rect. Точную проверку пересечения выполняет вызывающий код
+    std::vector<size_t> Query(const Rect& rect) const;
+
+private:
+    Rect bounds_;
+    size_t cols_ = 1;
+    size_t rows_ = 1;
+    double cell_width_ = 1;
+    double cell_height_ = 1;
+    std::vector<std::vector<size_t>> cells_;
+
+    size_t GetColumn(double x) const;
+    size_t GetRow(double y) const;
+};
+
+// Набор непересекающихся прямоугольников. Проверка нового прямоугольника
+// затрагивает только соседей по сетке, поэтому размещение n объектов почти линейно
+class PlacementGrid {
+public:
+    PlacementGrid(const Rect& bounds, size_t item_count);
+
+    // Добавляет rect, если он не пересекает добавленные ранее. Прямоугольники
+    // за границами сетки тоже проверяются
+    bool TryPlace(const Rect& rect);
+
+private:
+    Rect bounds_;
+    GridIndex index_;
+    std::vector<Rect> rects_;
+};
+
+}
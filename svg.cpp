@@ -1,4 +1,7 @@
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
 
 #include "svg.h"
 
@@ -6,6 +9,126 @@ namespace svg {
 
 using namespace std::literals;
 
+namespace {
+
+// Замены символов, которые нельзя выводить в тексте SVG как есть
+constexpr std::array<std::string_view, 256> MakeEscapeTable() {
+    std::array<std::string_view, 256> table{};
+    table['"'] = "&quot;"sv;
+    table['\''] = "&apos;"sv;
+    table['<'] = "&lt;"sv;
+    table['>'] = "&gt;"sv;
+    table['&'] = "&amp;"sv;
+    return table;
+}
+
+constexpr std::array<std::string_view, 256> ESCAPE_TABLE = MakeEscapeTable();
+
+// Начало тегов до атрибутов оформления. Используются и самими фигурами,
+// и контейнером, который хранит только геометрию и индекс оформления
+void RenderCircleHead(std::ostream& out, Point center, double radius) {
+    out << "<circle cx=\""sv << center.x << "\" cy=\""sv << center.y << "\" "sv;
+    out << "r=\""sv << radius << "\""sv;
+}
+
+void RenderPolylineHead(std::ostream& out, const Point* begin, const Point* end) {
+    out << "<polyline points=\""sv;
+    bool flag = false;
+    for(const Point* item = begin; item != end; ++item){
+        if(flag) {
+            out << ' ';
+        }
+        out << item->x << ',' << item->y;
+        if(!flag) {
+            flag = true;
+        }
+    }
+    out << "\""sv;
+}
+
+void RenderTextHead(std::ostream& out, Point position, Point offset) {
+    out << "<text x=\""sv << position.x << "\" y=\""sv << position.y << "\""sv;
+    out << " dx=\""sv << offset.x << "\" dy=\""sv << offset.y << "\""sv;
+}
+
+constexpr long long POW10[] = {1, 10, 100, 1000, 10000, 100000, 1000000,
+                               10000000, 100000000, 1000000000};
+
+// Предел значений в единицах 10^-precision: половина диапазона long long,
+// чтобы разность двух значений в path тоже не переполнялась
+constexpr double MAX_FIXED_UNITS = 4e18;
+
+// Значение в единицах 10^-precision. Не помещающиеся значения насыщаются
+long long ToFixed(double value, int precision) {
+    double units = std::fmin(std::fmax(value * POW10[precision], -MAX_FIXED_UNITS), MAX_FIXED_UNITS);
+    return std::llround(units);
+}
+
+// Наибольшая точность не выше заданной, при которой max_abs помещается в long long
+int FitPrecision(int precision, double max_abs) {
+    while(precision > 0 && max_abs * POW10[precision] > MAX_FIXED_UNITS) {
+        --precision;
+    }
+    return precision;
+}
+
+// Выводит units * 10^-precision без незначащих нулей
+void RenderFixed(std::ostream& out, long long units, int precision) {
+    if(units < 0) {
+        out << '-';
+        units = -units;
+    }
+    out << units / POW10[precision];
+
+    long long fraction = units % POW10[precision];
+    if(fraction == 0) {
+        return;
+    }
+
+    char digits[16];
+    int size = precision;
+    while(fraction % 10 == 0) {
+        fraction /= 10;
+        --size;
+    }
+    for(int i = size - 1; i >= 0; --i) {
+        digits[i] = static_cast<char>('0' + fraction % 10);
+        fraction /= 10;
+    }
+    out << '.';
+    out.write(digits, size);
+}
+
+void RenderFixedAttr(std::ostream& out, std::string_view name, double value, int precision) {
+    out << ' ' << name << "=\""sv;
+    RenderFixed(out, ToFixed(value, precision), precision);
+    out << '"';
+}
+
+void RenderClass(std::ostream& out, uint32_t style) {
+    out << " class=\"s"sv << style << '"';
+}
+
+template <typename T>
+void HashCombine(size_t& seed, const T& value) {
+    seed = seed * 37 + std::hash<T>{}(value);
+}
+
+size_t HashColor(const Color& color) {
+    size_t seed = color.index();
+    if(const auto* str = std::get_if<std::string>(&color)) {
+        HashCombine(seed, *str);
+    } else if(const auto* rgb = std::get_if<Rgb>(&color)) {
+        HashCombine(seed, (rgb->red << 16) | (rgb->green << 8) | rgb->blue);
+    } else if(const auto* rgba = std::get_if<Rgba>(&color)) {
+        HashCombine(seed, (rgba->red << 16) | (rgba->green << 8) | rgba->blue);
+        HashCombine(seed, rgba->opacity);
+    }
+    return seed;
+}
+
+}  // namespace
+
 void Object::Render(const RenderContext& context) const {
     context.RenderIndent();
 
@@ -29,8 +152,7 @@ Circle& Circle::SetRadius(double radius)  {
 
 void Circle::RenderObject(const RenderContext& context) const {
     auto& out = context.out;
-    out << "<circle cx=\""sv << center_.x << "\" cy=\""sv << center_.y << "\" "sv;
-    out << "r=\""sv << radius_ << "\""sv;
+    RenderCircleHead(out, center_, radius_);
     RenderAttrs(out);
     out << " />"sv;
 }
@@ -44,37 +166,13 @@ Polyline& Polyline::AddPoint(Point point) {
 
 void Polyline::RenderObject(const RenderContext& context) const {
     auto& out = context.out;
-    out << "<polyline points=\""sv;
-    bool flag = false;
-    for(const auto& item : points_){
-        if(flag) {
-            out << " ";
-        }
-        out << item.x << ","s << item.y;
-        if(!flag) {
-            flag = true;
-        }
-    }
-    out << "\""sv;
+    RenderPolylineHead(out, points_.data(), points_.data() + points_.size());
     RenderAttrs(out);
     out << " />"sv;
 }
 
 // ---------- Text ------------------
 
-std::unordered_map<char, std::string> GetMap() {
-    using namespace std;
-    std::unordered_map<char, std::string> replace_symbols = {
-        {'"', "&quot;"s},
-        {'\'', "&apos;"s},
-        {'<', "&lt;"s},
-        {'>', "&gt;"s},
-        {'&', "&amp;"s}
-    };
-
-    return replace_symbols;
-}
-
 // Задаёт координаты опорной точки (атрибуты x и y)
 Text& Text::SetPosition(Point pos) {
     position_ = pos;
@@ -95,42 +193,34 @@ Text& Text::SetFontSize(uint32_t size) {
 
 // Задаёт название шрифта (атрибут font-family)
 Text& Text::SetFontFamily(std::string font_family) {
-    font_family_ = font_family;
+    font_family_ = std::move(font_family);
     return *this;
 }
 
 // Задаёт толщину шрифта (атрибут font-weight)
 Text& Text::SetFontWeight(std::string font_weight) {
-    font_weight_ = font_weight;
+    font_weight_ = std::move(font_weight);
     return *this;
 }
 
 // Задаёт текстовое содержимое объекта (отображается внутри тега text)
 Text& Text::SetData(std::string data) {
     data_.clear();
-    std::unordered_map<char, std::string> tmp_map = GetMap();
-
-    std::for_each(
-                data.begin(),
-                data.end(),
-                [&](char item){
-                    if(tmp_map.find(item) != tmp_map.end()) {
-                        for(char i : tmp_map.at(item)) {
-                            data_ += i;
-                        }
-                    } else {
-                        data_ += item;
-                    }
-                }
-             );
+    data_.reserve(data.size());
+
+    for(char item : data) {
+        std::string_view replace = ESCAPE_TABLE[static_cast<unsigned char>(item)];
+        if(replace.empty()) {
+            data_ += item;
+        } else {
+            data_ += replace;
+        }
+    }
 
     return *this;
 }
 
-void Text::RenderObject(const RenderContext& context) const {
-    auto& out = context.out;
-    out << "<text x=\""sv << position_.x << "\" y=\""sv << position_.y << "\""sv;
-    out << " dx=\""sv << offset_.x << "\" dy=\""sv << offset_.y << "\""sv;
+void Text::RenderFontAttrs(std::ostream& out) const {
     out << " font-size=\""sv << font_size_ << "\""sv;
 
     if(!font_family_.empty()) {
@@ -140,7 +230,12 @@ void Text::RenderObject(const RenderContext& context) const {
     if(!font_weight_.empty()) {
         out << " font-weight=\""sv << font_weight_ << "\""sv;
     }
+}
 
+void Text::RenderObject(const RenderContext& context) const {
+    auto& out = context.out;
+    RenderTextHead(out, position_, offset_);
+    RenderFontAttrs(out);
     RenderAttrs(out);
     out << ">"sv;
     out << data_;
@@ -149,28 +244,308 @@ void Text::RenderObject(const RenderContext& context) const {
 
 // ---------- Document ------------------
 
-std::vector<std::unique_ptr<Object>>& ObjectContainer::GetObjects() {
-    return objects_;
+bool ObjectContainer::Style::operator==(const Style& other) const {
+    return is_text == other.is_text
+            && fill_color == other.fill_color
+            && stroke_color == other.stroke_color
+            && stroke_width == other.stroke_width
+            && line_cap == other.line_cap
+            && line_join == other.line_join
+            && font_size == other.font_size
+            && font_family == other.font_family
+            && font_weight == other.font_weight;
 }
 
-const std::vector<std::unique_ptr<Object>>& ObjectContainer::GetObjects() const {
-    return objects_;
+size_t ObjectContainer::StyleHasher::operator()(const Style& style) const {
+    size_t seed = style.is_text;
+    HashCombine(seed, HashColor(style.fill_color));
+    HashCombine(seed, HashColor(style.stroke_color));
+    HashCombine(seed, style.stroke_width.value_or(-1.0));
+    HashCombine(seed, style.line_cap ? static_cast<int>(*style.line_cap) : -1);
+    HashCombine(seed, style.line_join ? static_cast<int>(*style.line_join) : -1);
+    HashCombine(seed, style.font_size);
+    HashCombine(seed, style.font_family);
+    HashCombine(seed, style.font_weight);
+    return seed;
+}
+
+template <typename Owner>
+ObjectContainer::Style ObjectContainer::GetStyle(const PathProps<Owner>& props) {
+    Style style;
+    style.fill_color = props.fill_color_;
+    style.stroke_color = props.stroke_color_;
+    style.stroke_width = props.stroke_width_;
+    style.line_cap = props.line_cap_;
+    style.line_join = props.line_join_;
+    return style;
+}
+
+uint32_t ObjectContainer::InternStyle(Style&& style) {
+    auto it = style_indexes_.find(style);
+    if(it != style_indexes_.end()) {
+        return it->second;
+    }
+
+    // Фрагмент выводится так же, как его вывели бы сами фигуры
+    std::ostringstream strm;
+    if(style.is_text) {
+        Text text;
+        text.SetFontSize(style.font_size)
+            .SetFontFamily(style.font_family)
+            .SetFontWeight(style.font_weight);
+        text.RenderFontAttrs(strm);
+    }
+
+    Circle props;
+    props.SetFillColor(style.fill_color)
+        .SetStrokeColor(style.stroke_color);
+    props.stroke_width_ = style.stroke_width;
+    props.line_cap_ = style.line_cap;
+    props.line_join_ = style.line_join;
+    props.RenderAttrs(strm);
+
+    uint32_t index = static_cast<uint32_t>(styles_.size());
+    styles_.push_back(strm.str());
+    style_indexes_.emplace(std::move(style), index);
+    return index;
+}
+
+void ObjectContainer::Clear() {
+    order_.clear();
+    circles_.clear();
+    texts_.clear();
+    polylines_.clear();
+    points_.clear();
+    objects_.clear();
+}
+
+void ObjectContainer::AddCircle(Circle&& circle) {
+    order_.push_back({Kind::CIRCLE, static_cast<uint32_t>(circles_.size())});
+    circles_.push_back({circle.center_, circle.radius_, InternStyle(GetStyle(circle))});
+}
+
+void ObjectContainer::AddPolyline(Polyline&& polyline) {
+    order_.push_back({Kind::POLYLINE, static_cast<uint32_t>(polylines_.size())});
+
+    size_t begin = points_.size();
+    points_.insert(points_.end(), polyline.points_.begin(), polyline.points_.end());
+
+    polylines_.push_back({begin, points_.size(), InternStyle(GetStyle(polyline))});
+}
+
+void ObjectContainer::AddText(Text&& text) {
+    order_.push_back({Kind::TEXT, static_cast<uint32_t>(texts_.size())});
+
+    Style style = GetStyle(text);
+    style.is_text = true;
+    style.font_size = text.font_size_;
+    style.font_family = std::move(text.font_family_);
+    style.font_weight = std::move(text.font_weight_);
+
+    texts_.push_back({text.position_, text.offset_,
+                      InternStyle(std::move(style)), std::move(text.data_)});
+}
+
+void ObjectContainer::AddObject(std::unique_ptr<Object>&& obj) {
+    order_.push_back({Kind::OBJECT, static_cast<uint32_t>(objects_.size())});
+    objects_.emplace_back(std::move(obj));
+}
+
+void ObjectContainer::RenderObjects(const RenderContext& context) const {
+    auto& out = context.out;
+
+    for(const Item& item : order_) {
+        if(item.kind == Kind::OBJECT) {
+            objects_[item.index]->Render(context);
+            continue;
+        }
+
+        context.RenderIndent();
+
+        if(item.kind == Kind::CIRCLE) {
+            const CircleItem& circle = circles_[item.index];
+            RenderCircleHead(out, circle.center, circle.radius);
+            out << styles_[circle.style] << " />"sv;
+        } else if(item.kind == Kind::TEXT) {
+            const TextItem& text = texts_[item.index];
+            RenderTextHead(out, text.position, text.offset);
+            out << styles_[text.style] << ">"sv << text.data << "</text>"sv;
+        } else {
+            const PolylineItem& polyline = polylines_[item.index];
+            RenderPolylineHead(out,
+                               points_.data() + polyline.begin,
+                               points_.data() + polyline.end);
+            out << styles_[polyline.style] << " />"sv;
+        }
+
+        out << '\n';
+    }
+}
+
+void ObjectContainer::RenderCompactObjects(std::ostream& out, const CompactOptions& options) const {
+    // Точность снижается для всего контейнера сразу, если координаты слишком велики.
+    // Значения, которые насытятся и при нулевой точности, а также NaN, не учитываются
+    double max_abs = 0;
+    auto update = [&max_abs](double value) {
+        if(std::abs(value) <= MAX_FIXED_UNITS) {
+            max_abs = std::max(max_abs, std::abs(value));
+        }
+    };
+    for(const CircleItem& circle : circles_) {
+        update(circle.center.x);
+        update(circle.center.y);
+        update(circle.radius);
+    }
+    for(const TextItem& text : texts_) {
+        update(text.position.x);
+        update(text.position.y);
+        update(text.offset.x);
+        update(text.offset.y);
+    }
+    for(const Point& point : points_) {
+        update(point.x);
+        update(point.y);
+    }
+    int precision = FitPrecision(std::clamp(options.precision, 0, 9), max_abs);
+
+    for(const Item& item : order_) {
+        if(item.kind == Kind::OBJECT) {
+            objects_[item.index]->Render(out);
+            continue;
+        }
+
+        if(item.kind == Kind::CIRCLE) {
+            const CircleItem& circle = circles_[item.index];
+            out << "<circle"sv;
+            RenderFixedAttr(out, "cx"sv, circle.center.x, precision);
+            RenderFixedAttr(out, "cy"sv, circle.center.y, precision);
+            RenderFixedAttr(out, "r"sv, circle.radius, precision);
+            RenderClass(out, circle.style);
+            out << "/>"sv;
+        } else if(item.kind == Kind::TEXT) {
+            const TextItem& text = texts_[item.index];
+            out << "<text"sv;
+            RenderFixedAttr(out, "x"sv, text.position.x, precision);
+            RenderFixedAttr(out, "y"sv, text.position.y, precision);
+            RenderFixedAttr(out, "dx"sv, text.offset.x, precision);
+            RenderFixedAttr(out, "dy"sv, text.offset.y, precision);
+            RenderClass(out, text.style);
+            out << ">"sv << text.data << "</text>"sv;
+        } else {
+            const PolylineItem& polyline = polylines_[item.index];
+            const Point* begin = points_.data() + polyline.begin;
+            const Point* end = points_.data() + polyline.end;
+
+            if(options.use_paths) {
+                // Смещения считаются между уже округлёнными точками, поэтому ошибка не накапливается
+                out << "<path d=\""sv;
+                if(begin != end) {
+                    long long x = ToFixed(begin->x, precision);
+                    long long y = ToFixed(begin->y, precision);
+                    out << 'M';
+                    RenderFixed(out, x, precision);
+                    out << ',';
+                    RenderFixed(out, y, precision);
+
+                    for(const Point* point = begin + 1; point != end; ++point) {
+                        long long next_x = ToFixed(point->x, precision);
+                        long long next_y = ToFixed(point->y, precision);
+                        out << (point == begin + 1 ? 'l' : ' ');
+                        RenderFixed(out, next_x - x, precision);
+                        out << ',';
+                        RenderFixed(out, next_y - y, precision);
+                        x = next_x;
+                        y = next_y;
+                    }
+                }
+                out << '"';
+            } else {
+                out << "<polyline points=\""sv;
+                for(const Point* point = begin; point != end; ++point) {
+                    if(point != begin) {
+                        out << ' ';
+                    }
+                    RenderFixed(out, ToFixed(point->x, precision), precision);
+                    out << ',';
+                    RenderFixed(out, ToFixed(point->y, precision), precision);
+                }
+                out << '"';
+            }
+            RenderClass(out, polyline.style);
+            out << "/>"sv;
+        }
+
+        out << '\n';
+    }
+}
+
+void ObjectContainer::RenderStyleSheet(std::ostream& out) const {
+    if(styles_.empty()) {
+        return;
+    }
+
+    // Фрагменты вида ' name="value"' превращаются в правила 'name:value'.
+    // В CSS размерам нужны единицы измерения
+    out << "<style>"sv;
+    for(size_t i = 0; i < styles_.size(); ++i) {
+        out << ".s"sv << i << '{';
+        std::string_view attrs = styles_[i];
+        bool is_first = true;
+        while(!attrs.empty()) {
+            size_t name_begin = attrs.find_first_not_of(' ');
+            size_t name_end = attrs.find("=\""sv, name_begin);
+            if(name_begin == attrs.npos || name_end == attrs.npos) {
+                break;
+            }
+            size_t value_end = attrs.find('"', name_end + 2);
+            std::string_view name = attrs.substr(name_begin, name_end - name_begin);
+            std::string_view value = attrs.substr(name_end + 2, value_end - name_end - 2);
+
+            if(!is_first) {
+                out << ';';
+            }
+            is_first = false;
+            out << name << ':' << value;
+            if(name == "font-size"sv || name == "stroke-width"sv) {
+                out << "px"sv;
+            }
+
+            attrs.remove_prefix(std::min(attrs.size(), value_end + 1));
+        }
+        out << '}';
+    }
+    out << "</style>\n"sv;
 }
 
 void Document::AddPtr(std::unique_ptr<Object>&& obj) {
-    GetObjects().emplace_back(std::move(obj));
+    AddObject(std::move(obj));
 }
 
 void Document::Render(std::ostream& out) const {
+    RenderBegin(out);
+    RenderBody(out);
+    RenderEnd(out);
+}
+
+void Document::RenderBegin(std::ostream& out) {
     out << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>"sv << std::endl;
     out << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">"sv << std::endl;
+}
 
-    for(const auto& item : GetObjects()) {
-        item->Render(out);
-    }
+void Document::RenderBody(std::ostream& out) const {
+    RenderObjects(out);
+}
 
+void Document::RenderEnd(std::ostream& out) {
     out << "</svg>"sv;
 }
 
-}  // namespace svg
+void Document::RenderCompactBody(std::ostream& out, const CompactOptions& options) const {
+    RenderCompactObjects(out, options);
+}
+
+void Document::RenderStyleSheet(std::ostream& out) const {
+    ObjectContainer::RenderStyleSheet(out);
+}
 
+}  // namespace svg
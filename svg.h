@@ -9,15 +9,23 @@
 #include <vector>
 #include <unordered_map>
 #include <variant>
+#include <type_traits>
 #include <iomanip>      // std::setprecision
 
 namespace svg {
 
+class ObjectContainer;
+
 struct Rgb {
     Rgb() = default;
     Rgb(uint8_t r, uint8_t g, uint8_t b)
         : red(r), green(g), blue(b)
     {}
+
+    bool operator==(const Rgb& other) const {
+        return red == other.red && green == other.green && blue == other.blue;
+    }
+
     uint8_t red = 0;
     uint8_t green = 0;
     uint8_t blue = 0;
@@ -28,6 +36,12 @@ struct Rgba {
     Rgba(uint8_t r, uint8_t g, uint8_t b, double a)
         : red(r), green(g), blue(b), opacity(a)
     {}
+
+    bool operator==(const Rgba& other) const {
+        return red == other.red && green == other.green && blue == other.blue
+                && opacity == other.opacity;
+    }
+
     uint8_t red = 0;
     uint8_t green = 0;
     uint8_t blue = 0;
@@ -171,16 +185,16 @@ protected:
     void RenderAttrs(std::ostream& out) const {
         using namespace std::literals;
 
-        std::ostringstream strm;
-        visit(SolutionPrinter{strm}, fill_color_);
-        if(!strm.str().empty()) {
-            out << " fill=\""sv << strm.str() << "\""sv;
+        if(!IsEmptyColor(fill_color_)) {
+            out << " fill=\""sv;
+            visit(SolutionPrinter{out}, fill_color_);
+            out << "\""sv;
         }
 
-        std::ostringstream strm2;
-        visit(SolutionPrinter{strm2}, stroke_color_);
-        if(!strm2.str().empty()) {
-            out << " stroke=\""sv << strm2.str() << "\""sv;
+        if(!IsEmptyColor(stroke_color_)) {
+            out << " stroke=\""sv;
+            visit(SolutionPrinter{out}, stroke_color_);
+            out << "\""sv;
         }
 
         if (stroke_width_) {
@@ -197,6 +211,15 @@ protected:
     }
 
 private:
+    friend class ObjectContainer;
+
+    static bool IsEmptyColor(const Color& color) {
+        if(const auto* str = std::get_if<std::string>(&color)) {
+            return str->empty();
+        }
+        return std::holds_alternative<std::monostate>(color);
+    }
+
     Owner& AsOwner() {
         // static_cast безопасно преобразует *this к Owner&,
         // если класс Owner — наследник PathProps
@@ -265,6 +288,8 @@ public:
     Circle& SetRadius(double radius);
 
 private:
+    friend class ObjectContainer;
+
     void RenderObject(const RenderContext& context) const override;
 
     Point center_;
@@ -281,6 +306,8 @@ public:
     Polyline& AddPoint(Point point);
 
 private:
+    friend class ObjectContainer;
+
     void RenderObject(const RenderContext& context) const override;
     std::vector<Point> points_;
 };
@@ -310,7 +337,10 @@ public:
     Text& SetData(std::string data);
 
 private:
+    friend class ObjectContainer;
+
     void RenderObject(const RenderContext& context) const override;
+    void RenderFontAttrs(std::ostream& out) const;
 
     Point position_;
     Point offset_;
@@ -320,22 +350,122 @@ private:
     std::string data_;
 };
 
+// Компактный вывод: оформление фигур выносится в классы CSS, координаты округляются
+struct CompactOptions {
+    // Число знаков после запятой у координат и размеров, от 0 до 9. Снижается,
+    // если при такой точности координаты не помещаются в long long
+    int precision = 2;
+    // Ломаные выводятся элементом <path> с относительными координатами
+    bool use_paths = false;
+};
+
+/*
+ * Объекты хранятся не по одному в куче, а в непрерывных массивах своего типа:
+ * окружности, тексты и ломаные выводятся без виртуальных вызовов, а вершины
+ * всех ломаных лежат в одном общем массиве. Прочие наследники Object
+ * хранятся через unique_ptr. Порядок вывода совпадает с порядком добавления.
+ */
 class ObjectContainer {
 public:
     virtual void AddPtr(std::unique_ptr<Object>&&) = 0;
 
     template <typename Obj>
     void Add(Obj obj) {
-        objects_.emplace_back(std::make_unique<Obj>(std::move(obj)));
+        if constexpr (std::is_same_v<Obj, Circle>) {
+            AddCircle(std::move(obj));
+        } else if constexpr (std::is_same_v<Obj, Polyline>) {
+            AddPolyline(std::move(obj));
+        } else if constexpr (std::is_same_v<Obj, Text>) {
+            AddText(std::move(obj));
+        } else {
+            AddObject(std::make_unique<Obj>(std::move(obj)));
+        }
     }
 
+    // Удаляет все объекты. Таблица стилей сохраняется для следующих объектов
+    void Clear();
+
 protected:
     ~ObjectContainer() = default;
-    std::vector<std::unique_ptr<Object>>& GetObjects();
-    const std::vector<std::unique_ptr<Object>>& GetObjects() const;
+
+    void AddObject(std::unique_ptr<Object>&& obj);
+    void RenderObjects(const RenderContext& context) const;
+    // Фигуры ссылаются на оформление атрибутом class, классы выводит RenderStyleSheet
+    void RenderCompactObjects(std::ostream& out, const CompactOptions& options) const;
+    // Элемент <style> со всеми стилями, встреченными с момента создания контейнера
+    void RenderStyleSheet(std::ostream& out) const;
 
 private:
+    enum class Kind : uint8_t {
+        CIRCLE,
+        POLYLINE,
+        TEXT,
+        OBJECT,
+    };
+
+    struct Item {
+        Kind kind;
+        uint32_t index;
+    };
+
+    // Набор атрибутов оформления. Атрибуты шрифта заполняются только для текста
+    struct Style {
+        bool is_text = false;
+        Color fill_color;
+        Color stroke_color;
+        std::optional<double> stroke_width;
+        std::optional<StrokeLineCap> line_cap;
+        std::optional<StrokeLineJoin> line_join;
+        uint32_t font_size = 0;
+        std::string font_family;
+        std::string font_weight;
+
+        bool operator==(const Style& other) const;
+    };
+
+    struct StyleHasher {
+        size_t operator()(const Style& style) const;
+    };
+
+    struct CircleItem {
+        Point center;
+        double radius = 0;
+        uint32_t style = 0;
+    };
+
+    struct TextItem {
+        Point position;
+        Point offset;
+        uint32_t style = 0;
+        std::string data;
+    };
+
+    // Диапазон вершин ломаной в points_
+    struct PolylineItem {
+        size_t begin = 0;
+        size_t end = 0;
+        uint32_t style = 0;
+    };
+
+    std::vector<Item> order_;
+    std::vector<CircleItem> circles_;
+    std::vector<TextItem> texts_;
+    std::vector<PolylineItem> polylines_;
+    std::vector<Point> points_;
     std::vector<std::unique_ptr<Object>> objects_;
+
+    // Каждый различный набор атрибутов сериализуется один раз,
+    // фигуры ссылаются на готовый фрагмент по индексу
+    std::vector<std::string> styles_;
+    std::unordered_map<Style, uint32_t, StyleHasher> style_indexes_;
+
+    template <typename Owner>
+    static Style GetStyle(const PathProps<Owner>& props);
+    uint32_t InternStyle(Style&& style);
+
+    void AddCircle(Circle&& circle);
+    void AddPolyline(Polyline&& polyline);
+    void AddText(Text&& text);
 };
 
 class Document : public ObjectContainer {
@@ -345,6 +475,18 @@ public:
 
     // Выводит в ostream svg-представление документа
     void Render(std::ostream& out) const;
+
+    // Части Render: заголовок, теги объектов и закрывающий тег.
+    // Позволяют собрать документ из независимо подготовленных частей
+    static void RenderBegin(std::ostream& out);
+    void RenderBody(std::ostream& out) const;
+    static void RenderEnd(std::ostream& out);
+
+    // Компактный вариант RenderBody. Таблица стилей выводится отдельно, в любом месте
+    // документа: правила <style> в SVG действуют на весь документ, поэтому её можно
+    // вывести после всех фигур, когда стили уже известны
+    void RenderCompactBody(std::ostream& out, const CompactOptions& options) const;
+    void RenderStyleSheet(std::ostream& out) const;
 };
 
 class Drawable {
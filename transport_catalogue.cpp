@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <algorithm>
+#include <numeric>
 
 using namespace domain;
 
@@ -21,19 +22,109 @@ namespace transport_list {
         return distance;
     }
 
-    void TransportCatalogue::AddStop(const std::string& name, const geo::Coordinates& coords) {
-        stops_list_.push_back({name, coords.lat, coords.lng});
-        Stop* last = &stops_list_[stops_list_.size()-1];
-        stops_.insert({last->title_, last});
+    size_t TransportCatalogue::GetRouteLength(const Bus* bus) {
+        if(route_distances_version_ != version_) {
+            ComputeRouteDistances();
+        }
+        return bus->road_distances_.empty() ? 0 : bus->road_distances_.back();
+    }
 
-        if(stop_buses_.find(last) == stop_buses_.end()) {
-            stop_buses_.insert({last, {}});
+    double TransportCatalogue::GetGeoLength(const Bus* bus) {
+        if(route_distances_version_ != version_) {
+            ComputeRouteDistances();
+        }
+        return bus->geo_distances_.empty() ? 0 : bus->geo_distances_.back();
+    }
+
+    std::optional<RouteSegment> TransportCatalogue::GetRouteSegment(const Bus* bus, size_t from, size_t to) {
+        if(from > to || to >= bus->stops_.size()) {
+            return std::nullopt;
+        }
+        if(route_distances_version_ != version_) {
+            ComputeRouteDistances();
+        }
+        return RouteSegment{bus->road_distances_[to] - bus->road_distances_[from],
+                            bus->geo_distances_[to] - bus->geo_distances_[from],
+                            to - from + 1};
+    }
+
+    void TransportCatalogue::ComputeRouteDistances() {
+        size_t segment_count = 0;
+        for(const auto& bus : buses_list_) {
+            segment_count += bus.stops_.empty() ? 0 : bus.stops_.size() - 1;
+        }
+
+        geo::PreparedArray from;
+        geo::PreparedArray to;
+        from.Reserve(segment_count);
+        to.Reserve(segment_count);
+        for(const auto& bus : buses_list_) {
+            for(size_t i = 1; i < bus.stops_.size(); ++i) {
+                from.Add(prepared_stops_, bus.stops_[i-1]->id_);
+                to.Add(prepared_stops_, bus.stops_[i]->id_);
+            }
         }
+
+        std::vector<double> distances;
+        geo::ComputeDistances(from, to, geo::DistanceFormula::HAVERSINE, distances);
+
+        auto distance = distances.begin();
+        for(auto& bus : buses_list_) {
+            bus.road_distances_.assign(1, 0);
+            bus.geo_distances_.assign(1, 0);
+            bus.road_distances_.reserve(bus.stops_.size());
+            bus.geo_distances_.reserve(bus.stops_.size());
+            for(size_t i = 1; i < bus.stops_.size(); ++i) {
+                bus.road_distances_.push_back(bus.road_distances_.back()
+                                              + GetDistance(bus.stops_[i-1], bus.stops_[i]));
+                bus.geo_distances_.push_back(bus.geo_distances_.back() + *distance++);
+            }
+        }
+        route_distances_version_ = version_;
+    }
+
+    void TransportCatalogue::SetDistance(Stop* from, Stop* to, size_t distance) {
+        stops_distances_.insert_or_assign({from, to}, distance);
+        ++version_;
+    }
+
+    size_t TransportCatalogue::GetVersion() const {
+        return version_;
+    }
+
+    uint64_t TransportCatalogue::GetContentHash() const {
+        return content_hash_;
+    }
+
+    void TransportCatalogue::SetCompactCoordinates(bool compact) {
+        stop_columns_.SetCompact(compact);
+    }
+
+    bool TransportCatalogue::HasCompactCoordinates() const {
+        return stop_columns_.IsCompact();
+    }
+
+    void TransportCatalogue::AddStop(const std::string& name, const geo::Coordinates& input_coords) {
+        ++version_;
+        size_t id = stop_columns_.Add(name, input_coords);
+        geo::Coordinates coords = stop_columns_.GetCoordinates(id);
+        prepared_stops_.Add(geo::PreparedCoordinates::From(coords));
+        Stop* last = &stops_list_.emplace_back(&stop_columns_, id);
+        stops_.insert({last->GetTitle(), last});
+
+        // Сумма хэшей элементов не зависит от порядка их добавления
+        content_hash_ += detail::ContentHasher()
+                .AddString("Stop")
+                .AddString(name)
+                .AddValue(coords.lat)
+                .AddValue(coords.lng)
+                .Get();
     }
 
     void TransportCatalogue::AddBus(const std::string& name,
                                     const std::deque<std::string>& stops,
                                     bool is_round, const std::string& last_stop) {
+        ++version_;
         std::vector<Stop*> loc_stops(stops.size());
         std::transform(
                     stops.begin(),
@@ -44,12 +135,14 @@ namespace transport_list {
                     }
                  );
         buses_list_.push_back(Bus(name, loc_stops, is_round, stops_.at(last_stop)));
-        Bus* last = &buses_list_[buses_list_.size()-1];
 
-        for(const auto& stop : last->stops_) {
-            stop_buses_.at(stop).insert(last->title_);
+        detail::ContentHasher hasher;
+        hasher.AddString("Bus").AddString(name);
+        for(const auto& stop : stops) {
+            hasher.AddString(stop);
         }
-
+        content_hash_ += hasher.AddValue(is_round).AddString(last_stop).Get();
+        Bus* last = &buses_list_[buses_list_.size()-1];
         buses_.insert({last->title_, last});
     }
 
@@ -76,11 +169,69 @@ namespace transport_list {
     }
 
     std::optional<std::set<std::string>> TransportCatalogue::GetStopInfo(const std::string& name) const {
-        if(stops_.find(name) == stops_.end()) {
+        auto it = stops_.find(name);
+        if(it == stops_.end()) {
             return std::nullopt;
         }
 
-        return stop_buses_.at(stops_.at(name));
+        if(bus_lists_version_ != version_) {
+            BuildBusLists();
+        }
+
+        size_t id = it->second->id_;
+        std::set<std::string> result;
+        for(size_t i = bus_list_offsets_[id]; i < bus_list_offsets_[id + 1]; ++i) {
+            result.emplace_hint(result.end(), stop_buses_[i]->title_);
+        }
+        return result;
+    }
+
+    void TransportCatalogue::BuildBusLists() const {
+        // Сначала число посещений каждой остановки, затем раскладка маршрутов по их местам
+        std::vector<size_t> offsets(stops_list_.size() + 1, 0);
+        for(const auto& bus : buses_list_) {
+            for(const Stop* stop : bus.stops_) {
+                ++offsets[stop->id_ + 1];
+            }
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+        std::vector<const Bus*> buses(offsets.back());
+        std::vector<size_t> positions(offsets.begin(), offsets.end() - 1);
+        for(const auto& bus : buses_list_) {
+            for(const Stop* stop : bus.stops_) {
+                buses[positions[stop->id_]++] = &bus;
+            }
+        }
+
+        // Списки сортируются по имени маршрута и сдвигаются к началу без повторов
+        bus_list_offsets_.assign(1, 0);
+        bus_list_offsets_.reserve(stops_list_.size() + 1);
+        size_t size = 0;
+        for(size_t id = 0; id < stops_list_.size(); ++id) {
+            auto first = buses.begin() + offsets[id];
+            auto last = buses.begin() + offsets[id + 1];
+            std::sort(first, last, [](const Bus* lhs, const Bus* rhs) {
+                return lhs->title_ < rhs->title_;
+            });
+            last = std::unique(first, last, [](const Bus* lhs, const Bus* rhs) {
+                return lhs->title_ == rhs->title_;
+            });
+            size = std::move(first, last, buses.begin() + size) - buses.begin();
+            bus_list_offsets_.push_back(size);
+        }
+        buses.resize(size);
+
+        stop_buses_ = std::move(buses);
+        bus_lists_version_ = version_;
+    }
+
+    const geo::CoordinatesArray& TransportCatalogue::GetStopCoordinates() const {
+        return stop_columns_.GetCoordinatesArray();
+    }
+
+    const geo::FixedCoordinatesArray& TransportCatalogue::GetFixedStopCoordinates() const {
+        return stop_columns_.GetFixedCoordinatesArray();
     }
 
     const std::unordered_map<std::string_view, Stop*>& TransportCatalogue::GetAllStops() const {
@@ -13,8 +13,21 @@
 
 namespace transport_list {
 
+    // Участок маршрута между двумя его остановками
+    struct RouteSegment {
+        size_t road_distance = 0;
+        double geo_distance = 0;
+        // Остановки участка, включая первую и последнюю
+        size_t stop_count = 0;
+    };
+
     class TransportCatalogue {
     public:
+        // Координаты остановок хранятся с фиксированной точкой (шаг около 1 см) и при
+        // добавлении округляются до этого шага. Режим задаётся до добавления остановок
+        void SetCompactCoordinates(bool compact);
+        bool HasCompactCoordinates() const;
+
         void AddStop(const std::string& name, const geo::Coordinates& coords);
         // deque используется потому что потом из массива stops формируется массив указателей
         void AddBus(const std::string& name, const std::deque<std::string>& stops,
@@ -24,23 +37,60 @@ namespace transport_list {
         const domain::Bus* SearchBus(const std::string& name);
 
         domain::Bus* GetBusInfo(const std::string& name) const;
+        // Списки маршрутов всех остановок строятся при первом запросе после изменения
+        // справочника, поэтому одновременные вызовы из разных потоков недопустимы
         std::optional<std::set<std::string>> GetStopInfo(const std::string& name) const;
 
         size_t GetDistance(domain::Stop* from, domain::Stop* to) const;
+        // Длины маршрута по дорогам и по прямым между остановками. После изменения
+        // справочника при первом запросе расстояния всех маршрутов считаются одним пакетом
+        size_t GetRouteLength(const domain::Bus* bus);
+        double GetGeoLength(const domain::Bus* bus);
+        // Участок от остановки с номером from до остановки с номером to в bus->stops_,
+        // за O(1). nullopt, если from > to или to за концом маршрута
+        std::optional<RouteSegment> GetRouteSegment(const domain::Bus* bus, size_t from, size_t to);
+        void SetDistance(domain::Stop* from, domain::Stop* to, size_t distance);
+
+        // Увеличивается при каждом изменении справочника
+        size_t GetVersion() const;
+        // Хэш остановок и маршрутов. Одинаков для одинаковых справочников в разных
+        // запусках и не зависит от порядка добавления. Расстояния в него не входят
+        uint64_t GetContentHash() const;
 
         static int GetUniqueStopsCount(const std::vector<domain::Stop*>& stops);
 
+        // Координаты остановок по их номерам (Stop::id_). Заполнен один из массивов,
+        // в зависимости от HasCompactCoordinates
+        const geo::CoordinatesArray& GetStopCoordinates() const;
+        const geo::FixedCoordinatesArray& GetFixedStopCoordinates() const;
+
         const std::unordered_map<std::string_view, domain::Stop*>& GetAllStops() const;
         const std::unordered_map<std::string_view, domain::Bus*>& GetAllBuses() const;
         std::unordered_map<std::pair<domain::Stop*, domain::Stop*>, size_t, domain::detail::StopsHasher>& GetStopsDistances();
 
     private:
+        size_t version_ = 0;
+        uint64_t content_hash_ = 0;
+        std::optional<size_t> route_distances_version_;
+        domain::StopColumns stop_columns_;
+        // Радианы и точки на единичной сфере для остановок по их номерам. Считаются
+        // один раз в AddStop, пересчёт расстояний маршрутов тригонометрию не повторяет
+        geo::PreparedArray prepared_stops_;
+        // Представления строк stop_columns_
         std::deque<domain::Stop> stops_list_;
+        // Ключи - имена из stop_columns_
         std::unordered_map<std::string_view, domain::Stop*> stops_;
         std::deque<domain::Bus> buses_list_;
         std::unordered_map<std::string_view, domain::Bus*> buses_;
-        std::unordered_map<domain::Stop*, std::set<std::string>> stop_buses_;
+        // Маршруты остановки id, по имени и без повторов:
+        // stop_buses_[bus_list_offsets_[id]] .. stop_buses_[bus_list_offsets_[id + 1] - 1]
+        mutable std::optional<size_t> bus_lists_version_;
+        mutable std::vector<size_t> bus_list_offsets_;
+        mutable std::vector<const domain::Bus*> stop_buses_;
         std::unordered_map<std::pair<domain::Stop*, domain::Stop*>, size_t, domain::detail::StopsHasher> stops_distances_;
+
+        void ComputeRouteDistances();
+        void BuildBusLists() const;
     };
 }
 